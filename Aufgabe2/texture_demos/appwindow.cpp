@@ -23,9 +23,6 @@
 #include <QDateTime>
 #include <QDebug>
 
-const int BufferSize = 4096;
-
-
 AppWindow::AppWindow(QWidget *parent) :
     QWidget(parent),
     ui(new Ui::AppWindow)
@@ -110,6 +107,24 @@ AppWindow::AppWindow(QWidget *parent) :
     m_canvas = new RenderArea(this);
     ui->verticalLayout_5->addWidget(m_canvas);
 
+    // file sources are driven by the rendered frames (fixed step) or by the
+    // meter timer (real time), not at the audio buffer rate
+    m_audioSnapshot = std::make_shared<AudioSnapshot>();
+    m_audioClock.start();
+    connect(ui->openGLWidget, &QOpenGLWidget::frameSwapped, [this] {
+        if (m_audioSource && m_audioSource->frameDriven())
+            m_audioSource->advance(m_audioClock.restart() / 1000.0);
+    });
+
+    // the level meter reads the latest analysis on a timer of its own,
+    // so it keeps moving while the scene is not redrawn; the timer only
+    // runs while a source is active (see startAudio)
+    connect(&m_meterTimer, &QTimer::timeout, [this] {
+        if (m_audioSource && !m_audioSource->frameDriven())
+            m_audioSource->advance(m_audioClock.restart() / 1000.0);
+        m_canvas->setLevel(m_audioSnapshot->read().level);
+    });
+
     const QAudioDeviceInfo &defaultDeviceInfo = QAudioDeviceInfo::defaultInputDevice();
     ui->comboBox->addItem(defaultDeviceInfo.deviceName(), qVariantFromValue(defaultDeviceInfo));
     foreach (const QAudioDeviceInfo &deviceInfo, QAudioDeviceInfo::availableDevices(QAudio::AudioInput)) {
@@ -118,7 +133,15 @@ AppWindow::AppWindow(QWidget *parent) :
     }
     connect(ui->comboBox, SIGNAL(activated(int)), SLOT(deviceChanged(int)));
 
-    initializeAudio();
+    m_device = defaultDeviceInfo;
+
+    // the source is chosen later, see useAudioInput() / useAudioFile()
+    m_format.setSampleRate(44100);
+    m_format.setChannelCount(1);
+    m_format.setSampleSize(32);
+    m_format.setSampleType(QAudioFormat::SignedInt);
+    m_format.setByteOrder(QAudioFormat::LittleEndian);
+    m_format.setCodec("audio/pcm");
 }
 
 RenderArea::RenderArea(QWidget *parent)
@@ -160,57 +183,21 @@ void RenderArea::setLevel(qreal value)
 
 
 
-AudioInfo::AudioInfo(const QAudioFormat &format, QObject *parent)
+AudioInfo::AudioInfo(const QAudioFormat &format, std::shared_ptr<AudioSnapshot> snapshot,
+                     QObject *parent)
     :   QIODevice(parent)
     ,   m_format(format)
-    ,   m_maxAmplitude(0)
+    ,   m_kernel(selectLevelKernel(format))
+    ,   m_valueBytes(format.sampleSize() / 8)
     ,   m_level(0.0)
+    ,   m_rms(0.0)
+    ,   m_sampleKernel(selectSampleKernel(format))
+    ,   m_spectrum(format.sampleRate())
+    ,   m_snapshot(snapshot)
 
 {
-    switch (m_format.sampleSize()) {
-    case 8:
-        switch (m_format.sampleType()) {
-        case QAudioFormat::UnSignedInt:
-            m_maxAmplitude = 255;
-            break;
-        case QAudioFormat::SignedInt:
-            m_maxAmplitude = 127;
-            break;
-        default:
-            break;
-        }
-        break;
-    case 16:
-        switch (m_format.sampleType()) {
-        case QAudioFormat::UnSignedInt:
-            m_maxAmplitude = 65535;
-            break;
-        case QAudioFormat::SignedInt:
-            m_maxAmplitude = 32767;
-            break;
-        default:
-            break;
-        }
-        break;
-
-    case 32:
-        switch (m_format.sampleType()) {
-        case QAudioFormat::UnSignedInt:
-            m_maxAmplitude = 0xffffffff;
-            break;
-        case QAudioFormat::SignedInt:
-            m_maxAmplitude = 0x7fffffff;
-            break;
-        case QAudioFormat::Float:
-            m_maxAmplitude = 0x7fffffff; // Kind of
-        default:
-            break;
-        }
-        break;
-
-    default:
-        break;
-    }
+    if (!m_kernel)
+        qWarning() << "AudioInfo: unsupported sample format, level stays at 0";
 }
 
 AudioInfo::~AudioInfo()
@@ -237,126 +224,70 @@ qint64 AudioInfo::readData(char *data, qint64 maxlen)
 
 qint64 AudioInfo::writeData(const char *data, qint64 len)
 {
-    if (m_maxAmplitude) {
+    if (m_kernel) {
         Q_ASSERT(m_format.sampleSize() % 8 == 0);
-        const int channelBytes = m_format.sampleSize() / 8;
-        const int sampleBytes = m_format.channelCount() * channelBytes;
-        Q_ASSERT(len % sampleBytes == 0);
-        const int numSamples = len / sampleBytes;
-
-        quint32 maxValue = 0;
-        const unsigned char *ptr = reinterpret_cast<const unsigned char *>(data);
-
-        for (int i = 0; i < numSamples; ++i) {
-            for (int j = 0; j < m_format.channelCount(); ++j) {
-                quint32 value = 0;
-
-                if (m_format.sampleSize() == 8 && m_format.sampleType() == QAudioFormat::UnSignedInt) {
-                    value = *reinterpret_cast<const quint8*>(ptr);
-                } else if (m_format.sampleSize() == 8 && m_format.sampleType() == QAudioFormat::SignedInt) {
-                    value = qAbs(*reinterpret_cast<const qint8*>(ptr));
-                } else if (m_format.sampleSize() == 16 && m_format.sampleType() == QAudioFormat::UnSignedInt) {
-                    if (m_format.byteOrder() == QAudioFormat::LittleEndian)
-                        value = qFromLittleEndian<quint16>(ptr);
-                    else
-                        value = qFromBigEndian<quint16>(ptr);
-                } else if (m_format.sampleSize() == 16 && m_format.sampleType() == QAudioFormat::SignedInt) {
-                    if (m_format.byteOrder() == QAudioFormat::LittleEndian)
-                        value = qAbs(qFromLittleEndian<qint16>(ptr));
-                    else
-                        value = qAbs(qFromBigEndian<qint16>(ptr));
-                } else if (m_format.sampleSize() == 32 && m_format.sampleType() == QAudioFormat::UnSignedInt) {
-                    if (m_format.byteOrder() == QAudioFormat::LittleEndian)
-                        value = qFromLittleEndian<quint32>(ptr);
-                    else
-                        value = qFromBigEndian<quint32>(ptr);
-                } else if (m_format.sampleSize() == 32 && m_format.sampleType() == QAudioFormat::SignedInt) {
-                    if (m_format.byteOrder() == QAudioFormat::LittleEndian)
-                        value = qAbs(qFromLittleEndian<qint32>(ptr));
-                    else
-                        value = qAbs(qFromBigEndian<qint32>(ptr));
-                } else if (m_format.sampleSize() == 32 && m_format.sampleType() == QAudioFormat::Float) {
-                    value = qAbs(*reinterpret_cast<const float*>(ptr) * 0x7fffffff); // assumes 0-1.0
-                }
-
-                maxValue = qMax(value, maxValue);
-                ptr += channelBytes;
-            }
-        }
+        Q_ASSERT(len % (m_format.channelCount() * m_valueBytes) == 0);
 
-        maxValue = qMin(maxValue, m_maxAmplitude);
-        m_level = qreal(maxValue) / m_maxAmplitude;
+        // channels are interleaved, the kernel does not need to tell them apart
+        AudioLevel level = m_kernel(reinterpret_cast<const unsigned char *>(data),
+                                    size_t(len / m_valueBytes));
+        m_level = level.peak;
+        m_rms = level.rms;
     }
 
-    emit update();
-    return len;
-}
-
-
-void AppWindow::initializeAudio()
-{
-    m_format.setSampleRate(44100);
-    m_format.setChannelCount(1);
-    m_format.setSampleSize(32);
-    m_format.setSampleType(QAudioFormat::SignedInt);
-    m_format.setByteOrder(QAudioFormat::LittleEndian);
-    m_format.setCodec("audio/pcm");
-
-    m_device = QAudioDeviceInfo::defaultInputDevice();
-
-    QAudioDeviceInfo info(m_device);
-    if (!info.isFormatSupported(m_format)) {
-        qWarning() << "Default format not supported - trying to use nearest";
-        m_format = info.nearestFormat(m_format);
+    if (m_sampleKernel) {
+        size_t numValues = size_t(len / m_valueBytes);
+        m_samples.resize(numValues);
+        m_sampleKernel(reinterpret_cast<const unsigned char *>(data), numValues, m_samples.data());
+        m_spectrum.addSamples(m_samples.data(), numValues / m_format.channelCount(),
+                              m_format.channelCount());
     }
 
-    //if (m_audioInfo)
-    //    delete m_audioInfo;
+    // no signal here: the renderer picks up the latest values once per frame
+    const std::vector<float>& bands = m_spectrum.bands();
+    m_snapshot->write(float(m_level), float(m_rms), m_spectrum.frameCount(),
+                      bands.data(), bands.size());
 
-    m_audioInfo  = new AudioInfo(m_format, this);
-    connect(m_audioInfo, SIGNAL(update()), SLOT(refreshDisplay()));
-    qWarning() << "rying to use nearest";
-    createAudioInput();
+    return len;
 }
 
-void AppWindow::createAudioInput()
+
+void AppWindow::useAudioInput()
 {
-    m_audioInput = new QAudioInput(m_device, m_format, this);
-    //qreal initialVolume = QAudio::convertVolume(m_audioInput->volume(),
-    //                                            QAudio::LinearVolumeScale,
-    //                                            QAudio::LogarithmicVolumeScale);
-    //m_volumeSlider->setValue(qRound(initialVolume * 100));
-    m_audioInfo->start();
-    m_audioInput->start(m_audioInfo);
+    startAudio(std::unique_ptr<AudioSource>(new LiveAudioSource(m_device, m_format)));
 }
 
-void AppWindow::readMore()
+void AppWindow::startAudio(std::unique_ptr<AudioSource> source)
 {
-    if (!m_audioInput){
-        qDebug() << "w";
-        return;
+    if (m_audioSource) {
+        m_meterTimer.stop();
+        m_audioSource->stop();
+        m_audioInfo->stop();
+        delete m_audioInfo;
     }
-    qint64 len = m_audioInput->bytesReady();
-    if (len > BufferSize)
-        len = BufferSize;
-    qint64 l = m_input->read(m_buffer.data(), len);
-    if (l > 0)
-        m_audioInfo->write(m_buffer.constData(), l);
+
+    m_audioSource = std::move(source);
+    m_audioInfo = new AudioInfo(m_audioSource->format(), m_audioSnapshot, this);
+    m_audioInfo->start();
+    m_audioSource->start(m_audioInfo);
+    m_audioClock.restart();
+    m_meterTimer.start(1000 / 30);
 }
-void AppWindow::refreshDisplay()
+
+bool AppWindow::useAudioFile(const QString &filename, bool fixedStep)
 {
-    m_canvas->setLevel(m_audioInfo->level());
-    scene().SetAmplitude(m_audioInfo->level());
+    auto mode = fixedStep? FileAudioSource::FixedStep : FileAudioSource::RealTime;
+    std::unique_ptr<FileAudioSource> source(new FileAudioSource(filename, m_format, mode));
+    if (!source->isValid())
+        return false;
+    startAudio(std::move(source));
+    return true;
 }
+
 void AppWindow::deviceChanged(int index)
 {
-    m_audioInfo->stop();
-    m_audioInput->stop();
-    m_audioInput->disconnect(this);
-    delete m_audioInput;
-
     m_device = ui->comboBox->itemData(index).value<QAudioDeviceInfo>();
-    initializeAudio();
+    useAudioInput();
 }
 // called when initially shown
 void AppWindow::setDefaultUIValues() {
@@ -381,6 +312,7 @@ void AppWindow::showEvent(QShowEvent *event)
 {
     if(!wasInitialized) {
         setDefaultUIValues();
+        scene().setAudioSnapshot(m_audioSnapshot);
         wasInitialized = true;
     }
     QWidget::showEvent(event); // hand to parent
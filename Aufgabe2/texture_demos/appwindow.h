@@ -4,8 +4,14 @@
 #include <QSettings>
 
 #include "scene.h"
+#include "audiolevel.h"
+#include "spectrum.h"
+#include "audiosnapshot.h"
+#include "audiosource.h"
 
 #include <QAudioInput>
+#include <QElapsedTimer>
+#include <QTimer>
 
 namespace Ui {
 class AppWindow;
@@ -31,24 +37,31 @@ class AudioInfo : public QIODevice
     Q_OBJECT
 
 public:
-    AudioInfo(const QAudioFormat &format, QObject *parent);
+    // results of each buffer are published to snapshot
+    AudioInfo(const QAudioFormat &format, std::shared_ptr<AudioSnapshot> snapshot, QObject *parent);
     ~AudioInfo();
 
     void start();
     void stop();
 
     qreal level() const { return m_level; }
+    qreal rms() const { return m_rms; }
 
     qint64 readData(char *data, qint64 maxlen);
     qint64 writeData(const char *data, qint64 len);
 
 private:
     const QAudioFormat m_format;
-    quint32 m_maxAmplitude;
-    qreal m_level; // 0.0 <= m_level <= 1.0
+    AudioLevelKernel m_kernel; // chosen once for m_format, nullptr if unsupported
+    int m_valueBytes;          // bytes per sample and channel
+    qreal m_level; // 0.0 <= m_level <= 1.0, peak of the last buffer
+    qreal m_rms;   // 0.0 <= m_rms <= 1.0
 
-signals:
-    void update();
+    AudioSampleKernel m_sampleKernel; // raw samples -> float, nullptr if unsupported
+    std::vector<float> m_samples;     // converted samples of the current buffer
+    SpectrumAnalyzer m_spectrum;
+
+    std::shared_ptr<AudioSnapshot> m_snapshot;
 };
 
 class RenderArea : public QWidget
@@ -80,6 +93,14 @@ public:
     // convenience shortcut to the OpenGL scene
     Scene &scene();
 
+    /* analyze the selected audio input device; call this or useAudioFile() once after construction */
+    void useAudioInput();
+
+    /* analyze a WAV or raw PCM file instead of the audio input, in real time.
+       fixedStep feeds 1/60 s per rendered frame regardless of the frame time, for
+       reproducible runs; the playback then stands still while no frames are rendered */
+    bool useAudioFile(const QString &filename, bool fixedStep);
+
 public slots:
 
     /* show buttons etc, and a border around the OpenGL widget */
@@ -104,11 +125,9 @@ protected:
 
 private slots:
     void deviceChanged(int number);
-    void refreshDisplay();
-    void readMore();
 private:
-    void initializeAudio();
-    void createAudioInput();
+    // replace the current audio source
+    void startAudio(std::unique_ptr<AudioSource> source);
     // this is the connection to the class that will come out of the UI designer
     Ui::AppWindow *ui;
 
@@ -120,10 +139,13 @@ private:
 
     RenderArea *m_canvas;
     QAudioDeviceInfo m_device;
-    AudioInfo *m_audioInfo;
+    AudioInfo *m_audioInfo = nullptr;
     QAudioFormat m_format;
-    QAudioInput *m_audioInput;
-    QIODevice *m_input;
-    QByteArray m_buffer;
+    std::unique_ptr<AudioSource> m_audioSource;
+    QElapsedTimer m_audioClock; // time since the audio source was last advanced
+    QTimer m_meterTimer;        // level meter and real-time file playback
+
+    // latest audio analysis, read by the scene once per frame and by the level meter
+    std::shared_ptr<AudioSnapshot> m_audioSnapshot;
 };
 
@@ -0,0 +1,378 @@
+#include "audiolevel.h"
+
+#include <qendian.h>
+#include <QtGlobal>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h> // memcpy
+#include <type_traits> // std::conditional, std::is_signed
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define AUDIOLEVEL_SSE2
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define AUDIOLEVEL_AVX2
+#endif
+
+namespace {
+
+// read one value of type T with the given byte order
+template<typename T, bool bigEndian>
+inline T load(const unsigned char* ptr)
+{
+    return bigEndian? qFromBigEndian<T>(ptr) : qFromLittleEndian<T>(ptr);
+}
+
+// normalize peak value and sum of squares to 0...1
+inline AudioLevel finish(double maxValue, double sumOfSquares, size_t n, double maxAmplitude)
+{
+    AudioLevel level;
+    if(n == 0)
+        return level;
+    level.peak = float(qMin(maxValue, maxAmplitude) / maxAmplitude);
+    level.rms  = float(qMin(sqrt(sumOfSquares / double(n)) / maxAmplitude, 1.0));
+    return level;
+}
+
+/*
+ *  Scalar kernel for integer formats. Signed values use their magnitude,
+ *  unsigned values are taken as they are.
+ */
+template<typename T, bool bigEndian, uint32_t maxAmplitude>
+AudioLevel integerLevel(const unsigned char* ptr, size_t n)
+{
+    // squares of 8 and 16 bit values can be summed up exactly as integers
+    using Sum = typename std::conditional<sizeof(T) <= 2, uint64_t, double>::type;
+
+    uint32_t maxValue = 0;
+    Sum sum = 0;
+    for(size_t i=0; i<n; i++, ptr += sizeof(T)) {
+        int64_t v = load<T,bigEndian>(ptr);
+        uint32_t value = uint32_t(v < 0? -v : v);
+        maxValue = qMax(maxValue, value);
+        sum += Sum(value) * Sum(value);
+    }
+    return finish(maxValue, double(sum), n, maxAmplitude);
+}
+
+// scalar kernel for 32 bit float, assumes values in -1...1
+template<bool bigEndian>
+AudioLevel floatLevel(const unsigned char* ptr, size_t n)
+{
+    float maxValue = 0;
+    double sum = 0;
+    for(size_t i=0; i<n; i++, ptr += sizeof(float)) {
+        quint32 bits = load<quint32,bigEndian>(ptr);
+        float v;
+        memcpy(&v, &bits, sizeof(float));
+        maxValue = qMax(maxValue, qAbs(v));
+        sum += double(v) * double(v);
+    }
+    return finish(maxValue, sum, n, 1.0);
+}
+
+/*
+ *  Conversion to float. Signed values are divided by the maximum amplitude,
+ *  unsigned values are shifted by half their range first.
+ */
+template<typename T, bool bigEndian, uint32_t maxAmplitude>
+void integerSamples(const unsigned char* ptr, size_t n, float* out)
+{
+    const bool isSigned = std::is_signed<T>::value;
+    const double offset = isSigned? 0.0 : (double(maxAmplitude) + 1.0) * 0.5;
+    const float scale = float(1.0 / (isSigned? double(maxAmplitude) : offset));
+    for(size_t i=0; i<n; i++, ptr += sizeof(T))
+        out[i] = float(double(load<T,bigEndian>(ptr)) - offset) * scale;
+}
+
+template<bool bigEndian>
+void floatSamples(const unsigned char* ptr, size_t n, float* out)
+{
+    if(!bigEndian == (Q_BYTE_ORDER == Q_LITTLE_ENDIAN)) {
+        memcpy(out, ptr, n * sizeof(float));
+        return;
+    }
+    for(size_t i=0; i<n; i++, ptr += sizeof(float)) {
+        quint32 bits = load<quint32,bigEndian>(ptr);
+        memcpy(&out[i], &bits, sizeof(float));
+    }
+}
+
+#ifdef AUDIOLEVEL_SSE2
+
+// horizontal maximum / sum helpers
+inline int16_t hmax_epi16(__m128i v)
+{
+    v = _mm_max_epi16(v, _mm_srli_si128(v, 8));
+    v = _mm_max_epi16(v, _mm_srli_si128(v, 4));
+    v = _mm_max_epi16(v, _mm_srli_si128(v, 2));
+    return int16_t(_mm_cvtsi128_si32(v));
+}
+inline uint64_t hsum_epi64(__m128i v)
+{
+    alignas(16) uint64_t lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), v);
+    return lanes[0] + lanes[1];
+}
+inline double hsum_pd(__m128d v)
+{
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+/*
+ *  16 bit signed little endian, 8 values per iteration.
+ *  |x| is computed with saturation, so -32768 becomes 32767, which
+ *  is clamped to the maximum amplitude anyway.
+ */
+AudioLevel s16leLevelSSE2(const unsigned char* ptr, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vmax = zero;
+    __m128i vsum = zero; // two 64 bit lanes
+
+    size_t i = 0;
+    for(; i+8 <= n; i += 8, ptr += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+        vmax = _mm_max_epi16(vmax, _mm_max_epi16(x, _mm_subs_epi16(zero, x)));
+        // x*x summed pairwise fits into an unsigned 32 bit value
+        __m128i sq = _mm_madd_epi16(x, x);
+        vsum = _mm_add_epi64(vsum, _mm_unpacklo_epi32(sq, zero));
+        vsum = _mm_add_epi64(vsum, _mm_unpackhi_epi32(sq, zero));
+    }
+
+    uint32_t maxValue = uint32_t(hmax_epi16(vmax));
+    double sum = double(hsum_epi64(vsum));
+    for(; i<n; i++, ptr += 2) {
+        int32_t v = qFromLittleEndian<qint16>(ptr);
+        uint32_t value = uint32_t(v < 0? -v : v);
+        maxValue = qMax(maxValue, value);
+        sum += double(value) * double(value);
+    }
+    return finish(maxValue, sum, n, 32767);
+}
+
+#ifndef AUDIOLEVEL_AVX2
+/*
+ *  32 bit signed little endian, 4 values per iteration.
+ *  The unsigned maximum is emulated with a signed compare on
+ *  biased values, squares are accumulated as doubles.
+ */
+AudioLevel s32leLevelSSE2(const unsigned char* ptr, size_t n)
+{
+    const __m128i bias = _mm_set1_epi32(int(0x80000000u));
+    __m128i vmax = bias; // biased zero
+    __m128d vsum = _mm_setzero_pd();
+
+    size_t i = 0;
+    for(; i+4 <= n; i += 4, ptr += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+        __m128i sign = _mm_srai_epi32(x, 31);
+        __m128i a = _mm_xor_si128(_mm_sub_epi32(_mm_xor_si128(x, sign), sign), bias);
+        __m128i gt = _mm_cmpgt_epi32(a, vmax);
+        vmax = _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, vmax));
+
+        __m128d lo = _mm_cvtepi32_pd(x);
+        __m128d hi = _mm_cvtepi32_pd(_mm_srli_si128(x, 8));
+        vsum = _mm_add_pd(vsum, _mm_add_pd(_mm_mul_pd(lo, lo), _mm_mul_pd(hi, hi)));
+    }
+
+    alignas(16) uint32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), _mm_xor_si128(vmax, bias));
+    uint32_t maxValue = qMax(qMax(lanes[0], lanes[1]), qMax(lanes[2], lanes[3]));
+    double sum = hsum_pd(vsum);
+    for(; i<n; i++, ptr += 4) {
+        int64_t v = qFromLittleEndian<qint32>(ptr);
+        uint32_t value = uint32_t(v < 0? -v : v);
+        maxValue = qMax(maxValue, value);
+        sum += double(value) * double(value);
+    }
+    return finish(maxValue, sum, n, 0x7fffffff);
+}
+#endif
+
+// 32 bit float, 4 values per iteration
+AudioLevel f32LevelSSE2(const unsigned char* ptr, size_t n)
+{
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 vmax = _mm_setzero_ps();
+    __m128d vsum = _mm_setzero_pd();
+
+    size_t i = 0;
+    for(; i+4 <= n; i += 4, ptr += 16) {
+        __m128 x = _mm_loadu_ps(reinterpret_cast<const float*>(ptr));
+        vmax = _mm_max_ps(vmax, _mm_and_ps(x, absMask));
+        __m128d lo = _mm_cvtps_pd(x);
+        __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+        vsum = _mm_add_pd(vsum, _mm_add_pd(_mm_mul_pd(lo, lo), _mm_mul_pd(hi, hi)));
+    }
+
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, vmax);
+    float maxValue = qMax(qMax(lanes[0], lanes[1]), qMax(lanes[2], lanes[3]));
+    double sum = hsum_pd(vsum);
+    for(; i<n; i++, ptr += 4) {
+        float v;
+        memcpy(&v, ptr, sizeof(float));
+        maxValue = qMax(maxValue, qAbs(v));
+        sum += double(v) * double(v);
+    }
+    return finish(maxValue, sum, n, 1.0);
+}
+
+#endif // AUDIOLEVEL_SSE2
+
+#ifdef AUDIOLEVEL_AVX2
+
+// 32 bit signed little endian, 8 values per iteration
+AudioLevel s32leLevelAVX2(const unsigned char* ptr, size_t n)
+{
+    __m256i vmax = _mm256_setzero_si256();
+    __m256d vsum = _mm256_setzero_pd();
+
+    size_t i = 0;
+    for(; i+8 <= n; i += 8, ptr += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+        // abs(INT_MIN) stays 0x80000000, which is the correct unsigned magnitude
+        vmax = _mm256_max_epu32(vmax, _mm256_abs_epi32(x));
+        __m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(x));
+        __m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(x, 1));
+        vsum = _mm256_add_pd(vsum, _mm256_add_pd(_mm256_mul_pd(lo, lo), _mm256_mul_pd(hi, hi)));
+    }
+
+    alignas(32) uint32_t lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), vmax);
+    alignas(32) double sums[4];
+    _mm256_store_pd(sums, vsum);
+
+    uint32_t maxValue = 0;
+    for(auto l : lanes)
+        maxValue = qMax(maxValue, l);
+    double sum = sums[0] + sums[1] + sums[2] + sums[3];
+    for(; i<n; i++, ptr += 4) {
+        int64_t v = qFromLittleEndian<qint32>(ptr);
+        uint32_t value = uint32_t(v < 0? -v : v);
+        maxValue = qMax(maxValue, value);
+        sum += double(value) * double(value);
+    }
+    return finish(maxValue, sum, n, 0x7fffffff);
+}
+
+#endif // AUDIOLEVEL_AVX2
+
+// kernel for the format, the scalar one unless vectorized
+AudioLevelKernel levelKernel(const QAudioFormat& format, bool vectorized)
+{
+    // the vectorized kernels read little endian values directly
+    const bool le = format.byteOrder() == QAudioFormat::LittleEndian;
+    const bool native = le == (Q_BYTE_ORDER == Q_LITTLE_ENDIAN);
+    const bool simd = vectorized && native;
+
+    switch (format.sampleSize()) {
+    case 8:
+        switch (format.sampleType()) {
+        case QAudioFormat::UnSignedInt:
+            return integerLevel<quint8, false, 255>;
+        case QAudioFormat::SignedInt:
+            return integerLevel<qint8, false, 127>;
+        default:
+            return nullptr;
+        }
+
+    case 16:
+        switch (format.sampleType()) {
+        case QAudioFormat::UnSignedInt:
+            return le? integerLevel<quint16, false, 65535> : integerLevel<quint16, true, 65535>;
+        case QAudioFormat::SignedInt:
+#ifdef AUDIOLEVEL_SSE2
+            if(le && simd)
+                return s16leLevelSSE2;
+#endif
+            return le? integerLevel<qint16, false, 32767> : integerLevel<qint16, true, 32767>;
+        default:
+            return nullptr;
+        }
+
+    case 32:
+        switch (format.sampleType()) {
+        case QAudioFormat::UnSignedInt:
+            return le? integerLevel<quint32, false, 0xffffffff> : integerLevel<quint32, true, 0xffffffff>;
+        case QAudioFormat::SignedInt:
+#if defined(AUDIOLEVEL_AVX2)
+            if(le && simd)
+                return s32leLevelAVX2;
+#elif defined(AUDIOLEVEL_SSE2)
+            if(le && simd)
+                return s32leLevelSSE2;
+#endif
+            return le? integerLevel<qint32, false, 0x7fffffff> : integerLevel<qint32, true, 0x7fffffff>;
+        case QAudioFormat::Float:
+#ifdef AUDIOLEVEL_SSE2
+            if(simd)
+                return f32LevelSSE2;
+#endif
+            return le? floatLevel<false> : floatLevel<true>;
+        default:
+            return nullptr;
+        }
+
+    default:
+        return nullptr;
+    }
+}
+
+} // namespace
+
+AudioLevelKernel selectLevelKernel(const QAudioFormat& format)
+{
+    return levelKernel(format, true);
+}
+
+AudioLevelKernel scalarLevelKernel(const QAudioFormat& format)
+{
+    return levelKernel(format, false);
+}
+
+AudioSampleKernel selectSampleKernel(const QAudioFormat& format)
+{
+    const bool le = format.byteOrder() == QAudioFormat::LittleEndian;
+
+    switch (format.sampleSize()) {
+    case 8:
+        switch (format.sampleType()) {
+        case QAudioFormat::UnSignedInt:
+            return integerSamples<quint8, false, 255>;
+        case QAudioFormat::SignedInt:
+            return integerSamples<qint8, false, 127>;
+        default:
+            return nullptr;
+        }
+
+    case 16:
+        switch (format.sampleType()) {
+        case QAudioFormat::UnSignedInt:
+            return le? integerSamples<quint16, false, 65535> : integerSamples<quint16, true, 65535>;
+        case QAudioFormat::SignedInt:
+            return le? integerSamples<qint16, false, 32767> : integerSamples<qint16, true, 32767>;
+        default:
+            return nullptr;
+        }
+
+    case 32:
+        switch (format.sampleType()) {
+        case QAudioFormat::UnSignedInt:
+            return le? integerSamples<quint32, false, 0xffffffff> : integerSamples<quint32, true, 0xffffffff>;
+        case QAudioFormat::SignedInt:
+            return le? integerSamples<qint32, false, 0x7fffffff> : integerSamples<qint32, true, 0x7fffffff>;
+        case QAudioFormat::Float:
+            return le? floatSamples<false> : floatSamples<true>;
+        default:
+            return nullptr;
+        }
+
+    default:
+        return nullptr;
+    }
+}
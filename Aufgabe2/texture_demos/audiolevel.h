@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QAudioFormat>
+
+#include <stddef.h> // size_t
+
+/*
+ *  Peak and RMS level of a buffer of PCM samples.
+ *
+ *  There is one kernel per sample format (size, type, byte order).
+ *  The kernel is chosen once with selectLevelKernel() when the audio
+ *  format is known, so the per-sample loop never looks at the format.
+ *  The common formats use SSE2 (or AVX2 if enabled at compile time).
+ *
+ *  Interleaved channels are simply treated as consecutive values.
+ *  Both levels are normalized to 0...1, using the same sample values
+ *  and maximum amplitudes as the original scalar code in AudioInfo
+ *  (unsigned formats are not re-centered around zero).
+ *
+ */
+
+struct AudioLevel {
+    float peak = 0;
+    float rms  = 0;
+};
+
+// data: raw sample bytes, numValues: number of samples * channels
+using AudioLevelKernel = AudioLevel (*)(const unsigned char* data, size_t numValues);
+
+// kernel for the given format, nullptr if the format is not supported
+AudioLevelKernel selectLevelKernel(const QAudioFormat& format);
+
+// plain scalar kernel for the format, the reference for the vectorized
+// ones (see bench/audiolevel_bench.cpp)
+AudioLevelKernel scalarLevelKernel(const QAudioFormat& format);
+
+/*
+ *  Conversion of raw samples to float in -1...1, e.g. for spectrum analysis.
+ *  Unlike the level kernels, unsigned formats are re-centered around zero.
+ */
+using AudioSampleKernel = void (*)(const unsigned char* data, size_t numValues, float* out);
+
+// kernel for the given format, nullptr if the format is not supported
+AudioSampleKernel selectSampleKernel(const QAudioFormat& format);
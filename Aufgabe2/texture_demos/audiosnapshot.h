@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h> // size_t
+#include <stdint.h>
+
+/*
+ *  Latest audio analysis, handed from the audio input to the renderer.
+ *
+ *  A seqlock: the single writer bumps the sequence number to an odd value,
+ *  stores the fields and bumps it again. Readers copy the fields and retry
+ *  if the sequence number was odd or has changed meanwhile. Neither side
+ *  ever blocks, and no signals or events are involved, so the renderer can
+ *  sample the latest values once per frame at no cost for the GUI thread.
+ *
+ *  The fields are relaxed atomics, so a torn copy that gets retried is
+ *  not a data race.
+ *
+ */
+
+class AudioSnapshot
+{
+public:
+
+    static const size_t maxBands = 64;
+
+    struct Data {
+        float level = 0;           // peak, 0...1
+        float rms = 0;             // 0...1
+        uint64_t spectrumFrame = 0; // changes whenever new bands are available
+        size_t numBands = 0;
+        float bands[maxBands] = {};
+    };
+
+    // only ever called from one thread at a time
+    void write(float level, float rms, uint64_t spectrumFrame,
+               const float* bands, size_t numBands)
+    {
+        uint32_t seq = sequence_.load(std::memory_order_relaxed);
+        sequence_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        level_.store(level, std::memory_order_relaxed);
+        rms_.store(rms, std::memory_order_relaxed);
+        spectrumFrame_.store(spectrumFrame, std::memory_order_relaxed);
+        numBands = numBands < maxBands? numBands : maxBands;
+        numBands_.store(numBands, std::memory_order_relaxed);
+        for(size_t i=0; i<numBands; i++)
+            bands_[i].store(bands[i], std::memory_order_relaxed);
+
+        sequence_.store(seq + 2, std::memory_order_release);
+    }
+
+    // consistent copy of the latest write, may be called from any thread
+    Data read() const
+    {
+        Data data;
+        uint32_t before, after;
+        do {
+            before = sequence_.load(std::memory_order_acquire);
+            data.level = level_.load(std::memory_order_relaxed);
+            data.rms = rms_.load(std::memory_order_relaxed);
+            data.spectrumFrame = spectrumFrame_.load(std::memory_order_relaxed);
+            data.numBands = numBands_.load(std::memory_order_relaxed);
+            for(size_t i=0; i<data.numBands; i++)
+                data.bands[i] = bands_[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence_.load(std::memory_order_relaxed);
+        } while((before & 1) || before != after);
+        return data;
+    }
+
+private:
+
+    std::atomic<uint32_t> sequence_{0};
+    std::atomic<float> level_{0}, rms_{0};
+    std::atomic<uint64_t> spectrumFrame_{0};
+    std::atomic<size_t> numBands_{0};
+    std::atomic<float> bands_[maxBands] = {};
+};
@@ -0,0 +1,162 @@
+#include "audiosource.h"
+
+#include <QAudioInput>
+#include <QIODevice>
+#include <QDebug>
+#include <qendian.h>
+
+#include <algorithm> // std::min
+#include <string.h> // memcmp
+
+using namespace std;
+
+LiveAudioSource::LiveAudioSource(const QAudioDeviceInfo& device, const QAudioFormat& format)
+    : device_(device), format_(format)
+{
+    if (!device_.isFormatSupported(format_)) {
+        qWarning() << "Default format not supported - trying to use nearest";
+        format_ = device_.nearestFormat(format_);
+    }
+}
+
+LiveAudioSource::~LiveAudioSource()
+{
+    stop();
+}
+
+void LiveAudioSource::start(QIODevice* sink)
+{
+    input_.reset(new QAudioInput(device_, format_));
+    input_->start(sink);
+}
+
+void LiveAudioSource::stop()
+{
+    if(input_)
+        input_->stop();
+    input_.reset();
+}
+
+FileAudioSource::FileAudioSource(const QString& filename, const QAudioFormat& rawFormat,
+                                 Mode mode, double framesPerSecond)
+    : file_(filename), format_(rawFormat), mode_(mode), framesPerSecond_(framesPerSecond)
+{
+    if(!file_.open(QIODevice::ReadOnly)) {
+        qWarning() << "FileAudioSource: cannot open" << filename;
+        return;
+    }
+
+    // the file stays mapped while the source exists, nothing is copied
+    const uchar* data = file_.map(0, file_.size());
+    if(!data) {
+        qWarning() << "FileAudioSource: cannot map" << filename;
+        return;
+    }
+
+    if(!parseWav_(data, file_.size())) {
+        samples_ = data;
+        numBytes_ = file_.size();
+    }
+
+    bytesPerFrame_ = format_.bytesPerFrame();
+    if(bytesPerFrame_ > 0)
+        numBytes_ -= numBytes_ % bytesPerFrame_;
+    if(bytesPerFrame_ <= 0 || numBytes_ <= 0) {
+        qWarning() << "FileAudioSource: no samples in" << filename;
+        samples_ = nullptr;
+        return;
+    }
+
+    qDebug() << "audio file" << filename << ":" << format_.sampleRate() << "Hz,"
+             << format_.channelCount() << "channels," << format_.sampleSize() << "bit,"
+             << double(numBytes_ / bytesPerFrame_) / format_.sampleRate() << "s";
+}
+
+FileAudioSource::~FileAudioSource()
+{
+    stop();
+}
+
+bool FileAudioSource::parseWav_(const uchar* data, qint64 size)
+{
+    if(size < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data+8, "WAVE", 4) != 0)
+        return false;
+
+    bool haveFormat = false;
+    qint64 pos = 12;
+    while(pos + 8 <= size) {
+        const uchar* chunk = data + pos;
+        qint64 chunkSize = qFromLittleEndian<quint32>(chunk + 4);
+        const uchar* body = chunk + 8;
+        qint64 available = min(chunkSize, size - pos - 8);
+
+        if(memcmp(chunk, "fmt ", 4) == 0 && available >= 16) {
+            quint16 tag      = qFromLittleEndian<quint16>(body);
+            quint16 channels = qFromLittleEndian<quint16>(body + 2);
+            quint32 rate     = qFromLittleEndian<quint32>(body + 4);
+            quint16 bits     = qFromLittleEndian<quint16>(body + 14);
+            // WAVE_FORMAT_EXTENSIBLE: actual format code starts the sub format GUID
+            if(tag == 0xFFFE && available >= 26)
+                tag = qFromLittleEndian<quint16>(body + 24);
+
+            format_.setSampleRate(int(rate));
+            format_.setChannelCount(channels);
+            format_.setSampleSize(bits);
+            format_.setByteOrder(QAudioFormat::LittleEndian);
+            format_.setCodec("audio/pcm");
+            if(tag == 3)
+                format_.setSampleType(QAudioFormat::Float);
+            else if(tag == 1)
+                format_.setSampleType(bits == 8? QAudioFormat::UnSignedInt : QAudioFormat::SignedInt);
+            else {
+                qWarning() << "FileAudioSource: unsupported WAV format" << tag;
+                format_.setSampleType(QAudioFormat::Unknown);
+            }
+            haveFormat = true;
+        }
+        else if(memcmp(chunk, "data", 4) == 0 && haveFormat) {
+            samples_ = body;
+            numBytes_ = available;
+            return true;
+        }
+
+        // chunks are padded to an even size
+        pos += 8 + chunkSize + (chunkSize & 1);
+    }
+
+    qWarning() << "FileAudioSource: WAV file without format or data";
+    return true;
+}
+
+void FileAudioSource::start(QIODevice* sink)
+{
+    sink_ = sink;
+    position_ = 0;
+    pendingFrames_ = 0;
+}
+
+void FileAudioSource::stop()
+{
+    sink_ = nullptr;
+}
+
+void FileAudioSource::advance(double seconds)
+{
+    if(!sink_ || !isValid())
+        return;
+
+    // at most one second at once, e.g. after the window was hidden
+    double step = mode_ == FixedStep? 1.0 / framesPerSecond_ : min(seconds, 1.0);
+    double frames = step * format_.sampleRate() + pendingFrames_;
+    qint64 wholeFrames = qint64(frames);
+    pendingFrames_ = frames - double(wholeFrames);
+
+    // deliver straight from the mapped file, wrapping around at its end
+    qint64 bytes = wholeFrames * bytesPerFrame_;
+    while(bytes > 0) {
+        qint64 chunk = min(bytes, numBytes_ - position_);
+        sink_->write(reinterpret_cast<const char*>(samples_ + position_), chunk);
+        position_ = (position_ + chunk) % numBytes_;
+        bytes -= chunk;
+    }
+}
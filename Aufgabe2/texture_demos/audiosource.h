@@ -0,0 +1,112 @@
+#pragma once
+
+#include <QAudioFormat>
+#include <QAudioDeviceInfo>
+#include <QFile>
+#include <QString>
+
+#include <memory> // std::unique_ptr
+
+class QAudioInput;
+class QIODevice;
+
+/*
+ *  Where the samples analyzed by AudioInfo come from.
+ *
+ *  A source writes raw PCM in format() into a sink device. Live sources
+ *  deliver whenever the sound card has data. File sources are driven
+ *  through advance(): in real time by a clock of their own, or with a
+ *  fixed step per rendered frame (frameDriven()), so a run over the same
+ *  file with the same frames always produces the same audio analysis.
+ *
+ */
+
+class AudioSource
+{
+public:
+    virtual ~AudioSource() {}
+
+    // format of the delivered samples
+    virtual QAudioFormat format() const = 0;
+
+    // start / stop writing samples into the sink
+    virtual void start(QIODevice* sink) = 0;
+    virtual void stop() = 0;
+
+    // called with the elapsed time since the last call: once per rendered
+    // frame if frameDriven(), else periodically
+    virtual void advance(double seconds) { Q_UNUSED(seconds) }
+
+    // advanced by the rendered frames? Then it pauses while nothing is drawn
+    virtual bool frameDriven() const { return false; }
+};
+
+/*
+ *  Samples from an audio input device. If the device does not support
+ *  the requested format, the nearest supported one is used.
+ */
+class LiveAudioSource : public AudioSource
+{
+public:
+    LiveAudioSource(const QAudioDeviceInfo& device, const QAudioFormat& format);
+    ~LiveAudioSource();
+
+    QAudioFormat format() const override { return format_; }
+    void start(QIODevice* sink) override;
+    void stop() override;
+
+private:
+    QAudioDeviceInfo device_;
+    QAudioFormat format_;
+    std::unique_ptr<QAudioInput> input_;
+};
+
+/*
+ *  Samples from a memory-mapped WAV file (PCM or float), or from a raw
+ *  PCM file in a given format. Playback loops at the end of the file.
+ *
+ *  RealTime feeds as many samples as the elapsed time covers, whether
+ *  frames are rendered or not. FixedStep feeds exactly 1/framesPerSecond
+ *  seconds of audio per rendered frame, independent of how fast the
+ *  frames are rendered; without frames (e.g. no animation running) the
+ *  playback stands still.
+ */
+class FileAudioSource : public AudioSource
+{
+public:
+    enum Mode { RealTime, FixedStep };
+
+    // rawFormat is only used for files without a WAV header
+    FileAudioSource(const QString& filename, const QAudioFormat& rawFormat,
+                    Mode mode = RealTime, double framesPerSecond = 60.0);
+    ~FileAudioSource();
+
+    // false if the file could not be opened, mapped or parsed
+    bool isValid() const { return samples_ != nullptr; }
+
+    QAudioFormat format() const override { return format_; }
+    void start(QIODevice* sink) override;
+    void stop() override;
+    void advance(double seconds) override;
+    bool frameDriven() const override { return mode_ == FixedStep; }
+
+private:
+    QFile file_;
+    QAudioFormat format_;
+    Mode mode_;
+    double framesPerSecond_;
+
+    // sample data inside the mapped file
+    const uchar* samples_ = nullptr;
+    qint64 numBytes_ = 0;
+    int bytesPerFrame_ = 0;
+
+    // read position in bytes, and fractional audio frames not yet delivered
+    qint64 position_ = 0;
+    double pendingFrames_ = 0;
+
+    QIODevice* sink_ = nullptr;
+
+    // find format and sample data of a WAV file, false if it is not one
+    bool parseWav_(const uchar* data, qint64 size);
+};
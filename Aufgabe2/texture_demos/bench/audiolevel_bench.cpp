@@ -0,0 +1,254 @@
+// Benchmark and check of the audio level kernels (see audiolevel.h):
+// for each sample format, the kernel chosen by selectLevelKernel() must
+// give the same levels as the scalar kernel, and both must give the same
+// peak as the per-sample loop of the original AudioInfo::writeData, on
+// random values and on the extreme values of the format. Exits with 1 on
+// any mismatch.
+
+#include "audiolevel.h"
+
+#include <QAudioFormat>
+#include <qendian.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Format {
+    const char* name;
+    int size;
+    QAudioFormat::SampleType type;
+    QAudioFormat::Endian order;
+};
+
+const Format formats[] = {
+    { "u8",    8, QAudioFormat::UnSignedInt, QAudioFormat::LittleEndian },
+    { "s8",    8, QAudioFormat::SignedInt,   QAudioFormat::LittleEndian },
+    { "u16le", 16, QAudioFormat::UnSignedInt, QAudioFormat::LittleEndian },
+    { "u16be", 16, QAudioFormat::UnSignedInt, QAudioFormat::BigEndian },
+    { "s16le", 16, QAudioFormat::SignedInt,   QAudioFormat::LittleEndian },
+    { "s16be", 16, QAudioFormat::SignedInt,   QAudioFormat::BigEndian },
+    { "u32le", 32, QAudioFormat::UnSignedInt, QAudioFormat::LittleEndian },
+    { "u32be", 32, QAudioFormat::UnSignedInt, QAudioFormat::BigEndian },
+    { "s32le", 32, QAudioFormat::SignedInt,   QAudioFormat::LittleEndian },
+    { "s32be", 32, QAudioFormat::SignedInt,   QAudioFormat::BigEndian },
+    { "f32le", 32, QAudioFormat::Float,       QAudioFormat::LittleEndian },
+    { "f32be", 32, QAudioFormat::Float,       QAudioFormat::BigEndian },
+};
+
+QAudioFormat audioFormat(const Format& f)
+{
+    QAudioFormat format;
+    format.setSampleRate(44100);
+    format.setChannelCount(1);
+    format.setSampleSize(f.size);
+    format.setSampleType(f.type);
+    format.setByteOrder(f.order);
+    format.setCodec("audio/pcm");
+    return format;
+}
+
+// store the low bytes of value in the format's byte order
+void store(unsigned char* ptr, uint32_t value, int bytes, bool bigEndian)
+{
+    for(int b=0; b<bytes; b++)
+        ptr[bigEndian? bytes-1-b : b] = (unsigned char)(value >> (8*b));
+}
+
+/*
+ *  numValues random values of the format, mostly quiet with some loud
+ *  ones; the extreme values (e.g. the most negative integer) go into
+ *  the first and last few places, inside and outside the vector loops.
+ */
+vector<unsigned char> makeData(const Format& f, size_t numValues, mt19937& random)
+{
+    const int bytes = f.size / 8;
+    const bool be = f.order == QAudioFormat::BigEndian;
+    vector<unsigned char> data(numValues * bytes);
+    uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    vector<uint32_t> extremes;
+    if(f.type == QAudioFormat::Float) {
+        for(float v : { 1.0f, -1.0f, 0.0f, -0.0f }) {
+            uint32_t bits;
+            memcpy(&bits, &v, 4);
+            extremes.push_back(bits);
+        }
+    } else {
+        uint32_t mask = f.size == 32? 0xffffffffu : (1u << f.size) - 1;
+        extremes = { 0, mask, mask >> 1, (mask >> 1) + 1, 1 }; // 0, max, max signed, min signed, 1
+    }
+
+    for(size_t i=0; i<numValues; i++) {
+        float v = unit(random) * (i % 64 == 0? 1.0f : 0.1f);
+        uint32_t value;
+        if(f.type == QAudioFormat::Float) {
+            memcpy(&value, &v, 4);
+        } else {
+            double range = f.size == 32? 4294967296.0 : double(1u << f.size);
+            double x = f.type == QAudioFormat::SignedInt? v * (range/2 - 1) : (v + 1) * 0.5 * (range - 1);
+            value = uint32_t(int64_t(x));
+        }
+        if(i < extremes.size())
+            value = extremes[i];
+        else if(numValues - i <= extremes.size())
+            value = extremes[numValues - i - 1];
+        store(&data[i * bytes], value, bytes, be);
+    }
+    return data;
+}
+
+/*
+ *  Peak level as computed by the original AudioInfo::writeData, one
+ *  switch on the format per value; kept as it was (besides the loop
+ *  over channels) as the reference the kernels are checked against.
+ *  Floats were read in native byte order only.
+ */
+float originalPeak(const QAudioFormat& format, const unsigned char* ptr, size_t numValues)
+{
+    quint32 maxAmplitude = 0;
+    switch (format.sampleSize()) {
+    case 8:
+        maxAmplitude = format.sampleType() == QAudioFormat::UnSignedInt? 255 : 127;
+        break;
+    case 16:
+        maxAmplitude = format.sampleType() == QAudioFormat::UnSignedInt? 65535 : 32767;
+        break;
+    case 32:
+        maxAmplitude = format.sampleType() == QAudioFormat::UnSignedInt? 0xffffffff : 0x7fffffff;
+        break;
+    }
+
+    const int channelBytes = format.sampleSize() / 8;
+    quint32 maxValue = 0;
+
+    for (size_t i = 0; i < numValues; ++i) {
+        quint32 value = 0;
+
+        if (format.sampleSize() == 8 && format.sampleType() == QAudioFormat::UnSignedInt) {
+            value = *reinterpret_cast<const quint8*>(ptr);
+        } else if (format.sampleSize() == 8 && format.sampleType() == QAudioFormat::SignedInt) {
+            value = qAbs(*reinterpret_cast<const qint8*>(ptr));
+        } else if (format.sampleSize() == 16 && format.sampleType() == QAudioFormat::UnSignedInt) {
+            if (format.byteOrder() == QAudioFormat::LittleEndian)
+                value = qFromLittleEndian<quint16>(ptr);
+            else
+                value = qFromBigEndian<quint16>(ptr);
+        } else if (format.sampleSize() == 16 && format.sampleType() == QAudioFormat::SignedInt) {
+            if (format.byteOrder() == QAudioFormat::LittleEndian)
+                value = qAbs(qFromLittleEndian<qint16>(ptr));
+            else
+                value = qAbs(qFromBigEndian<qint16>(ptr));
+        } else if (format.sampleSize() == 32 && format.sampleType() == QAudioFormat::UnSignedInt) {
+            if (format.byteOrder() == QAudioFormat::LittleEndian)
+                value = qFromLittleEndian<quint32>(ptr);
+            else
+                value = qFromBigEndian<quint32>(ptr);
+        } else if (format.sampleSize() == 32 && format.sampleType() == QAudioFormat::SignedInt) {
+            if (format.byteOrder() == QAudioFormat::LittleEndian)
+                value = qAbs(qFromLittleEndian<qint32>(ptr));
+            else
+                value = qAbs(qFromBigEndian<qint32>(ptr));
+        } else if (format.sampleSize() == 32 && format.sampleType() == QAudioFormat::Float) {
+            value = qAbs(*reinterpret_cast<const float*>(ptr) * 0x7fffffff); // assumes 0-1.0
+        }
+
+        maxValue = qMax(value, maxValue);
+        ptr += channelBytes;
+    }
+
+    if (numValues == 0)
+        return 0.0f;
+    maxValue = qMin(maxValue, maxAmplitude);
+    return float(qreal(maxValue) / maxAmplitude);
+}
+
+bool same(float a, float b)
+{
+    return fabs(a - b) <= 1e-5f * max(1.0f, fabs(b));
+}
+
+// megabytes per second of the kernel on data
+double throughput(AudioLevelKernel kernel, const vector<unsigned char>& data, size_t numValues)
+{
+    const int runs = 50;
+    volatile float sink = 0;
+    auto start = chrono::steady_clock::now();
+    for(int r=0; r<runs; r++)
+        sink = sink + kernel(data.data(), numValues).peak;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return runs * double(data.size()) / seconds / 1e6;
+}
+
+} // namespace
+
+int main()
+{
+#if defined(__AVX2__)
+    printf("vectorized kernels: SSE2 and AVX2\n");
+#elif defined(__SSE2__) || defined(_M_X64)
+    printf("vectorized kernels: SSE2 (build with -mavx2 for AVX2)\n");
+#else
+    printf("vectorized kernels: none\n");
+#endif
+
+    mt19937 random(1);
+    int failures = 0;
+
+    // odd sizes leave a remainder behind the vector loops
+    const size_t sizes[] = { 0, 1, 7, 15, 17, 33, 1000, 4099 };
+    const size_t benchValues = 1 << 20;
+
+    printf("%-6s %-6s %12s %12s\n", "format", "kernel", "scalar MB/s", "chosen MB/s");
+    for(const Format& f : formats) {
+        QAudioFormat format = audioFormat(f);
+        AudioLevelKernel chosen = selectLevelKernel(format);
+        AudioLevelKernel scalar = scalarLevelKernel(format);
+        if(!chosen || !scalar) {
+            printf("%-6s no kernel\n", f.name);
+            failures++;
+            continue;
+        }
+
+        // the original loop read floats in native byte order only
+        const bool checkOriginal = f.type != QAudioFormat::Float
+                || (f.order == QAudioFormat::LittleEndian) == (Q_BYTE_ORDER == Q_LITTLE_ENDIAN);
+
+        for(size_t n : sizes) {
+            for(int round=0; round<4; round++) {
+                vector<unsigned char> data = makeData(f, n, random);
+                AudioLevel a = chosen(data.data(), n), b = scalar(data.data(), n);
+                if(!same(a.peak, b.peak) || !same(a.rms, b.rms)) {
+                    printf("%-6s MISMATCH for %zu values: peak %g vs %g, rms %g vs %g\n",
+                           f.name, n, a.peak, b.peak, a.rms, b.rms);
+                    failures++;
+                }
+                if(!checkOriginal)
+                    continue;
+                float original = originalPeak(format, data.data(), n);
+                if(!same(a.peak, original) || !same(b.peak, original)) {
+                    printf("%-6s MISMATCH for %zu values: peak %g (chosen), %g (scalar) vs %g (original)\n",
+                           f.name, n, a.peak, b.peak, original);
+                    failures++;
+                }
+            }
+        }
+
+        vector<unsigned char> data = makeData(f, benchValues, random);
+        printf("%-6s %-6s %12.0f %12.0f\n", f.name, chosen == scalar? "scalar" : "simd",
+               throughput(scalar, data, benchValues), throughput(chosen, data, benchValues));
+    }
+
+    if(failures)
+        printf("%d mismatches\n", failures);
+    else
+        printf("all kernels match the scalar kernels and the original loop\n");
+    return failures? 1 : 0;
+}
@@ -0,0 +1,21 @@
+# PROJECT FILE FOR THE AUDIO LEVEL KERNEL BENCHMARK
+#
+# Checks the vectorized level kernels of audiolevel.cpp against the scalar
+# ones for every sample format, and reports the throughput of both.
+# The AVX2 kernel is only compiled in with AVX2 enabled, e.g.
+#   qmake "QMAKE_CXXFLAGS += -mavx2"
+
+CONFIG += c++14 console
+CONFIG -= app_bundle
+
+QT     += multimedia
+QT     -= gui
+
+INCLUDEPATH += ..
+
+HEADERS += \
+    ../audiolevel.h
+
+SOURCES += \
+    audiolevel_bench.cpp \
+    ../audiolevel.cpp
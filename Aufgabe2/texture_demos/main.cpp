@@ -3,6 +3,7 @@
 
 #include <QApplication>
 #include <QSurfaceFormat>
+#include <QCommandLineParser>
 
 #include "appwindow.h"
 
@@ -28,7 +29,24 @@ int main(int argc, char *argv[])
     QSurfaceFormat::setDefaultFormat(format);
 #endif
 
+    // optional audio file instead of the audio input, e.g. for benchmarks
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption audioFileOption("audio-file",
+                                       "Analyze a WAV or raw PCM file (44.1 kHz, mono, 32 bit) instead of the audio input.",
+                                       "file");
+    QCommandLineOption fixedStepOption("fixed-step",
+                                       "Feed the audio file in fixed steps of 1/60 s per frame, for reproducible runs.");
+    parser.addOption(audioFileOption);
+    parser.addOption(fixedStepOption);
+    parser.process(app);
+
+    // only one audio source is ever opened: the file, or else the input device
     AppWindow window;
+    if(!parser.isSet(audioFileOption))
+        window.useAudioInput();
+    else if(!window.useAudioFile(parser.value(audioFileOption), parser.isSet(fixedStepOption)))
+        qFatal("cannot use audio file %s", qPrintable(parser.value(audioFileOption)));
     window.show();
 
     return app.exec();
@@ -106,6 +106,27 @@ void TerrainMaterial::apply(){
     terrain.temple_bump->bind(5);
     prog_->setUniformValue("terrain.temple_displacement", 6);
     terrain.temple_displacement->bind(6);
+
+    if(tessellation.use) {
+        prog_->setUniformValue("tessellation.edgeLengthPx", tessellation.edgeLengthPx);
+        prog_->setUniformValue("tessellation.varianceScale", tessellation.varianceScale);
+        prog_->setUniformValue("tessellation.maxLevel", tessellation.maxLevel);
+        prog_->setUniformValue("tessellation.viewport", tessellation.viewport);
+        prog_->setUniformValue("varianceTexture", 7);
+        tessellation.varianceTexture->bind(7);
+    }
+
+    // no history texture yet: the spectrum does not lift the terrain
+    prog_->setUniformValue("spectrum.scale", spectrum.history? spectrum.scale : 0.0f);
+    if(spectrum.history) {
+        float rows = spectrum.history->height();
+        prog_->setUniformValue("spectrum.head", (spectrum.head + 0.5f) / rows);
+        prog_->setUniformValue("spectrum.length", (rows - 1.0f) / rows);
+        prog_->setUniformValue("spectrum.distanceRange", spectrum.distanceRange);
+        prog_->setUniformValue("spectrum.lateralRange", spectrum.lateralRange);
+        prog_->setUniformValue("spectrum.history", 8);
+        spectrum.history->bind(8);
+    }
 }
 
 
@@ -25,6 +25,10 @@ public:
     // getter for the program object
     QOpenGLShaderProgram& program() const { return *prog_; }
 
+    // vertices per patch if the program has tessellation stages,
+    // 0 means the mesh is drawn as plain triangles
+    virtual int patchVertices() const { return 0; }
+
 protected:
 
     // reference to underlying shader program
@@ -160,8 +164,31 @@ public:
         std::shared_ptr<QOpenGLTexture> tex;
     } displacement;
     QVector2D flyPosition;
+
+    // hardware tessellation (GL 4.0), only used with a tessellation program
+    struct Tessellation {
+        bool use = false;
+        float edgeLengthPx = 12.0;  // desired edge length on screen
+        float varianceScale = 8.0;  // more detail where the height maps are rough
+        float maxLevel = 64.0;
+        QVector2D viewport = QVector2D(1,1);
+        std::shared_ptr<QOpenGLTexture> varianceTexture;
+    } tessellation;
+
+    // audio spectrum history (one row per frame, ring buffer), lifts the terrain
+    struct Spectrum {
+        std::shared_ptr<QOpenGLTexture> history;
+        int head = 0;               // row of the newest spectrum
+        float scale = 1.0;
+        float distanceRange = 1.0;  // eye space distance covered by the history
+        float lateralRange = 0.5;   // eye space sideways distance covered by the bands
+    } spectrum;
+
     // bind underlying shader program and set required uniforms
     void apply() override;
+
+    // terrain is drawn as triangle patches when tessellating
+    int patchVertices() const override { return tessellation.use? 3 : 0; }
 };
 
 class SkyboxMaterial : public Material {
@@ -7,6 +7,11 @@
 
 using namespace std;
 
+// not part of the GL 3.2 headers on all platforms
+#ifndef GL_PATCHES
+#define GL_PATCHES 0x000E
+#endif
+
 
 // just a convenience constructor
 Mesh::Mesh(const string& filename,
@@ -38,8 +43,16 @@ Mesh::Mesh(shared_ptr<GeometryBuffers> geometry,
 void Mesh::draw()
 {
     material_->apply();
+
+    // tessellation programs consume patches instead of triangles
+    GLenum mode = GL_TRIANGLES;
+    if(material_->patchVertices() > 0) {
+        material_->program().setPatchVertexCount(material_->patchVertices());
+        mode = GL_PATCHES;
+    }
+
     vao_.bind();
-    glDrawElements(GL_TRIANGLES, GLsizei(geometry_->numIndices()), GL_UNSIGNED_INT, Q_NULLPTR);
+    glDrawElements(mode, GLsizei(geometry_->numIndices()), GL_UNSIGNED_INT, Q_NULLPTR);
     vao_.release();
 }
 
@@ -3,6 +3,10 @@
 #include <iostream> // std::cout etc.
 #include <assert.h> // assert()
 #include <random>   // random number generation
+#include <algorithm> // std::min, std::max
+#include <math.h>   // sqrt()
+
+#include <QImage>
 
 #include "geometries/cube.h" // geom::Cube
 #include "geometries/parametric.h" // geom::Sphere etc.
@@ -10,6 +14,42 @@
 
 using namespace std;
 
+// helper: roughness (standard deviation) of one or more height maps,
+// one texel per block of height map pixels, maximum over all maps
+static QImage makeVarianceMap(const vector<QImage>& heightMaps, int size)
+{
+    QImage result(size, size, QImage::Format_Grayscale8);
+    result.fill(0);
+
+    for(auto& img : heightMaps) {
+        QImage gray = img.convertToFormat(QImage::Format_Grayscale8);
+        int bw = max(1, gray.width()/size);
+        int bh = max(1, gray.height()/size);
+
+        for(int by=0; by<size; by++) {
+            uchar* out = result.scanLine(by);
+            for(int bx=0; bx<size; bx++) {
+                double sum = 0, sum2 = 0;
+                int n = 0;
+                for(int y=by*bh; y<min((by+1)*bh, gray.height()); y++) {
+                    const uchar* line = gray.constScanLine(y);
+                    for(int x=bx*bw; x<min((bx+1)*bw, gray.width()); x++) {
+                        double v = line[x] / 255.0;
+                        sum += v; sum2 += v*v; n++;
+                    }
+                }
+                if(n == 0)
+                    continue;
+                double mean = sum/n;
+                double sd = sqrt(max(0.0, sum2/n - mean*mean));
+                // a standard deviation of 0.25 already counts as maximum roughness
+                out[bx] = max(out[bx], uchar(qBound(0, int(sd*4.0*255.0), 255)));
+            }
+        }
+    }
+    return result;
+}
+
 Scene::Scene(QWidget* parent, QOpenGLContext *context) :
     QOpenGLFunctions(context),
     parent_(parent),
@@ -37,9 +77,18 @@ Scene::Scene(QWidget* parent, QOpenGLContext *context) :
     }
 
 
-    auto terrain_prog = createProgram(":/shaders/terrain.vert", ":/shaders/terrain.frag");
+    // tessellate the terrain in hardware if the context supports it (GL 4.0),
+    // else fall back to a dense grid displaced in the vertex shader
+    bool tessellate = QOpenGLShader::hasOpenGLShaders(QOpenGLShader::TessellationControl, context);
+    cout << "terrain tessellation: " << (tessellate? "hardware" : "not available, using dense grid") << endl;
+
+    auto terrain_prog = tessellate?
+                createProgram(":/shaders/terrain_tess.vert", ":/shaders/terrain.frag", "",
+                              ":/shaders/terrain.tesc", ":/shaders/terrain.tese") :
+                createProgram(":/shaders/terrain.vert", ":/shaders/terrain.frag");
     terrainMaterial_ = std::make_shared<TerrainMaterial>(terrain_prog);
     terrainMaterial_->light.position_EC = QVector3D(4,0,2);
+    terrainMaterial_->tessellation.use = tessellate;
 
     // load shader source files and compile them into OpenGL program objects
     auto planet_prog = createProgram(":/shaders/planet_with_bumps.vert", ":/shaders/planet_with_bumps.frag");
@@ -73,12 +122,30 @@ Scene::Scene(QWidget* parent, QOpenGLContext *context) :
     auto bumps  = std::make_shared<QOpenGLTexture>(QImage(":/assets/textures/earth_topography_2048_NRM.png").mirrored());
 
     auto terrain_tex  = std::make_shared<QOpenGLTexture>(QImage(":/assets/textures/alzheimer.jpg").mirrored());
-    auto terrain_disp   = std::make_shared<QOpenGLTexture>(QImage(":/assets/textures/alzheimer_bump.jpg").mirrored());
+    auto terrain_disp_img = QImage(":/assets/textures/alzheimer_bump.jpg").mirrored();
+    auto terrain_disp   = std::make_shared<QOpenGLTexture>(terrain_disp_img);
     auto terrain_bumps  = std::make_shared<QOpenGLTexture>(QImage(":/assets/textures/alzheimer_normal.jpg").mirrored());
     auto terrain_diffuse = std::make_shared<QOpenGLTexture>(QImage(":/assets/textures/alzheimer_diffuse.jpg").mirrored());
     auto terrain_temple = std::make_shared<QOpenGLTexture>(QImage(":/assets/textures/temple.jpg").mirrored());
     auto terrain_temple_bump = std::make_shared<QOpenGLTexture>(QImage(":/assets/textures/temple-normal.jpg").mirrored());
-    auto terrain_temple_displacement = std::make_shared<QOpenGLTexture>(QImage(":/assets/textures/temple-bump.jpg").mirrored());
+    auto terrain_temple_disp_img = QImage(":/assets/textures/temple-bump.jpg").mirrored();
+    auto terrain_temple_displacement = std::make_shared<QOpenGLTexture>(terrain_temple_disp_img);
+
+    // roughness of both terrain height maps, steers the tessellation levels
+    auto terrain_variance = std::make_shared<QOpenGLTexture>(
+                makeVarianceMap({terrain_disp_img, terrain_temple_disp_img}, 64));
+    terrain_variance->setWrapMode(QOpenGLTexture::Repeat);
+
+    // ring buffer of audio spectra, one row per frame, filled in draw()
+    auto spectrum_history = std::make_shared<QOpenGLTexture>(QOpenGLTexture::Target2D);
+    spectrum_history->setFormat(QOpenGLTexture::R32F);
+    spectrum_history->setSize(64, 64);
+    spectrum_history->allocateStorage(QOpenGLTexture::Red, QOpenGLTexture::Float32);
+    std::vector<float> silence(64*64, 0.0f);
+    spectrum_history->setData(QOpenGLTexture::Red, QOpenGLTexture::Float32, silence.data());
+    spectrum_history->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+    spectrum_history->setWrapMode(QOpenGLTexture::DirectionS, QOpenGLTexture::ClampToEdge);
+    spectrum_history->setWrapMode(QOpenGLTexture::DirectionT, QOpenGLTexture::Repeat);
 
 
     auto sky_box_tex = makeCubeMap(":/assets/textures");
@@ -101,6 +168,8 @@ Scene::Scene(QWidget* parent, QOpenGLContext *context) :
     terrainMaterial_->terrain.temple = terrain_temple;
     terrainMaterial_->terrain.temple_bump = terrain_temple_bump;
     terrainMaterial_->terrain.temple_displacement = terrain_temple_displacement;
+    terrainMaterial_->tessellation.varianceTexture = terrain_variance;
+    terrainMaterial_->spectrum.history = spectrum_history;
 
 
     skyboxMaterial->cubeMap = sky_box_tex;
@@ -114,7 +183,9 @@ Scene::Scene(QWidget* parent, QOpenGLContext *context) :
     meshes_["Cube"]   = std::make_shared<Mesh>(make_shared<geom::Cube>(), std);
     meshes_["Sphere"] = std::make_shared<Mesh>(make_shared<geom::Planet>(80,80), std);
     meshes_["Torus"]  = std::make_shared<Mesh>(make_shared<geom::Torus>(4, 2, 80,20), std);
-    meshes_["Rect"]   = std::make_shared<Mesh>(make_shared<geom::Rect>(500,500), terrainMaterial_);
+    // with tessellation, coarse base patches suffice (100x fewer vertices)
+    size_t terrain_patches = tessellate? 50 : 500;
+    meshes_["Rect"]   = std::make_shared<Mesh>(make_shared<geom::Rect>(terrain_patches,terrain_patches), terrainMaterial_);
     skyMesh_ = std::make_shared<Mesh>(make_shared<geom::Cube>(), skyboxMaterial);
 
     // pack each mesh into a scene node, along with a transform that scales
@@ -155,19 +226,40 @@ Scene::Scene(QWidget* parent, QOpenGLContext *context) :
 
 // helper to load shaders and create programs
 shared_ptr<QOpenGLShaderProgram>
-Scene::createProgram(const string& vertex, const string& fragment, const string& geom)
+Scene::createProgram(const string& vertex, const string& fragment, const string& geom,
+                     const string& tess_control, const string& tess_eval)
 {
     auto p = make_shared<QOpenGLShaderProgram>();
-    if(!p->addShaderFromSourceFile(QOpenGLShader::Vertex, vertex.c_str()))
+
+    // with Qt >= 5.9, sources are only compiled if Qt's program binary disk cache
+    // (keyed by the sources and the GL driver, in the user's cache directory) has
+    // no usable binary for them; a rejected binary falls back to compiling in link()
+    auto addShader = [&p](QOpenGLShader::ShaderType type, const string& file) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+        return p->addCacheableShaderFromSourceFile(type, file.c_str());
+#else
+        return p->addShaderFromSourceFile(type, file.c_str());
+#endif
+    };
+
+    if(!addShader(QOpenGLShader::Vertex, vertex))
         qFatal("could not add vertex shader");
-    if(!p->addShaderFromSourceFile(QOpenGLShader::Fragment, fragment.c_str()))
+    if(!addShader(QOpenGLShader::Fragment, fragment))
         qFatal("could not add fragment shader");
     if(!geom.empty()) {
-        if(!p->addShaderFromSourceFile(QOpenGLShader::Geometry, geom.c_str()))
+        if(!addShader(QOpenGLShader::Geometry, geom))
             qFatal("could not add geometryshader");
     }
+    if(!tess_control.empty()) {
+        if(!addShader(QOpenGLShader::TessellationControl, tess_control))
+            qFatal("could not add tessellation control shader");
+    }
+    if(!tess_eval.empty()) {
+        if(!addShader(QOpenGLShader::TessellationEvaluation, tess_eval))
+            qFatal("could not add tessellation evaluation shader");
+    }
     if(!p->link())
-        qFatal("could not link shader program");
+        qFatal("could not link shader program: %s", qPrintable(p->log()));
 
     return p;
 }
@@ -345,6 +437,23 @@ void Scene::draw()
     float t = millisec_since_first_draw.count() / 1000.0f;
     planetMaterial_->time = t;
 
+    // sample the audio analysis once per frame. A new spectrum goes into
+    // the next row of the history, a single small upload per frame
+    if(audio_) {
+        AudioSnapshot::Data audio = audio_->read();
+        terrainMaterial_->terrain.amplitude = audio.level;
+
+        auto& spectrum = terrainMaterial_->spectrum;
+        if(audio.spectrumFrame != lastSpectrumFrame_) {
+            lastSpectrumFrame_ = audio.spectrumFrame;
+            spectrum.head = (spectrum.head + 1) % spectrum.history->height();
+            spectrum.history->bind();
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, spectrum.head,
+                            GLsizei(min(size_t(spectrum.history->width()), audio.numBands)), 1,
+                            GL_RED, GL_FLOAT, audio.bands);
+        }
+    }
+
     // clear background, set OpenGL state
     glClearColor(bgcolor_[0], bgcolor_[1], bgcolor_[2], 1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -445,6 +554,7 @@ void Scene::updateViewport(size_t width, size_t height)
 {
     qDebug() << "viewport:" << width << "x" << height;
     camera_->setAspectRatio(float(width)/float(height));
+    terrainMaterial_->tessellation.viewport = QVector2D(width, height);
     glViewport(0,0,GLint(width),GLint(height));
 }
 
@@ -453,8 +563,3 @@ void Scene::SetInput(QVector3D in ){
     FlyInput = in;
 }
 
-void Scene::SetAmplitude(float amp)
-{
-    terrainMaterial_->terrain.amplitude = amp;
-}
-
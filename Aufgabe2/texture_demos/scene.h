@@ -11,6 +11,7 @@
 #include "camera.h"
 #include "node.h"
 #include "cubemap.h"
+#include "audiosnapshot.h"
 
 #include <memory> // std::unique_ptr
 #include <map>    // std::map
@@ -97,7 +98,8 @@ public slots:
 
     // adjust camera / viewport / ... if drawing surface changes
     void updateViewport(size_t width, size_t height);
-    void SetAmplitude(float amp);
+    // audio analysis to be sampled once per frame in draw()
+    void setAudioSnapshot(std::shared_ptr<const AudioSnapshot> snapshot) { audio_ = snapshot; }
 protected:
 
     // parent widget
@@ -156,7 +158,9 @@ protected:
     // helper for creating programs from shader files
     std::shared_ptr<QOpenGLShaderProgram> createProgram(const std::string& vertex,
                                                         const std::string& fragment,
-                                                        const std::string& geom = "");
+                                                        const std::string& geom = "",
+                                                        const std::string& tess_control = "",
+                                                        const std::string& tess_eval = "");
 
     // helper for creating a node scaled to size 1
     std::shared_ptr<Node> createNode(std::shared_ptr<Mesh> mesh, bool scale_to_1 = true);
@@ -167,5 +171,9 @@ protected:
     float flySpeed;
     float flyHeight;
 
+    // latest audio analysis, and the last spectrum that went into the history
+    std::shared_ptr<const AudioSnapshot> audio_;
+    uint64_t lastSpectrumFrame_ = 0;
+
 };
 
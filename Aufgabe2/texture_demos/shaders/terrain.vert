@@ -51,6 +51,25 @@ struct Terrain{
 
 };
 uniform Terrain terrain;
+
+// audio spectrum history, one row per frame, newest row at spectrum.head
+struct Spectrum {
+    sampler2D history;
+    float head;          // tex coord of the newest row
+    float length;        // tex coord distance from newest to oldest row
+    float scale;
+    float distanceRange; // eye space distance covered by the whole history
+    float lateralRange;  // eye space sideways distance covered by all bands
+};
+uniform Spectrum spectrum;
+
+// bass in the middle, higher bands to the sides, older spectra further away
+float spectrumLevel(vec4 pos_EC) {
+    float band = clamp(abs(pos_EC.x) / spectrum.lateralRange, 0.0, 1.0);
+    float age  = clamp(-pos_EC.z / spectrum.distanceRange, 0.0, 1.0) * spectrum.length;
+    return texture(spectrum.history, vec2(band, spectrum.head - age)).r * spectrum.scale;
+}
+
 // output - transformed to eye coordinates (EC)
 out vec4 position_EC;
 out vec3 normal_EC;
@@ -73,12 +92,13 @@ void main(void) {
     //if(displ * 40 >= 0.125)
     //    displ += templePos;
     pos += vec4(normal_MC,0)*templePos ;//* terrain.amplitude;
+    float audio = terrain.amplitude + spectrumLevel(modelViewMatrix * vec4(position_MC,1));
 
     if(templePos * 4 < 0.055){
-        pos += vec4(normal_MC,0)* displ * terrain.amplitude * 0.5;
+        pos += vec4(normal_MC,0)* displ * audio * 0.5;
     }
     if(templePos* 4 > 0.055 && templePos* 4  <= 0.06){
-        pos += vec4(normal_MC,0)* displ * terrain.amplitude * 0.2;
+        pos += vec4(normal_MC,0)* displ * audio * 0.2;
     }
     // vertex/fragment position in eye coordinates
     position_EC  = modelViewMatrix * pos;
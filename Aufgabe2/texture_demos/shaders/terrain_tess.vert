@@ -0,0 +1,31 @@
+/*
+ *
+ * vertex shader for the tessellated terrain: only passes the
+ * coarse base patch attributes on to the tessellation stages
+ *
+ */
+
+#version 400
+
+// in: position and normal vector in model coordinates (_MC)
+in vec3 position_MC;
+in vec3 normal_MC;
+in vec3 tangent_MC;
+in vec3 bitangent_MC;
+in vec2 texcoord;
+
+// out: same attributes, per control point
+out vec3 tc_position_MC;
+out vec3 tc_normal_MC;
+out vec3 tc_tangent_MC;
+out vec3 tc_bitangent_MC;
+out vec2 tc_texcoord;
+
+void main(void) {
+
+    tc_position_MC  = position_MC;
+    tc_normal_MC    = normal_MC;
+    tc_tangent_MC   = tangent_MC;
+    tc_bitangent_MC = bitangent_MC;
+    tc_texcoord     = texcoord;
+}
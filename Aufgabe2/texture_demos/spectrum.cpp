@@ -0,0 +1,158 @@
+#include "spectrum.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h> // memmove
+#include <algorithm> // std::min, std::max
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SPECTRUM_SSE2
+#endif
+
+using namespace std;
+
+static const float pi = 3.14159265f;
+
+SpectrumAnalyzer::SpectrumAnalyzer(int sampleRate, size_t numBands, size_t fftSize,
+                                   size_t hop, float minFrequency)
+    : fftSize_(fftSize), hop_(hop),
+      input_(fftSize, 0.0f),
+      window_(fftSize),
+      bitReverse_(fftSize),
+      re_(fftSize), im_(fftSize),
+      bands_(numBands, 0.0f)
+{
+    assert(fftSize >= 4 && (fftSize & (fftSize-1)) == 0);
+    assert(hop > 0 && hop <= fftSize);
+
+    // Hann window
+    for(size_t i=0; i<fftSize; i++)
+        window_[i] = 0.5f - 0.5f*cos(2.0f*pi*float(i)/float(fftSize));
+
+    // bit reversal permutation
+    size_t bits = 0;
+    while((size_t(1) << bits) < fftSize)
+        bits++;
+    for(size_t i=0; i<fftSize; i++) {
+        unsigned int r = 0;
+        for(size_t b=0; b<bits; b++)
+            if(i & (size_t(1) << b))
+                r |= 1u << (bits-1-b);
+        bitReverse_[i] = r;
+    }
+
+    // twiddle factors for each stage stored one after another,
+    // so the butterfly loop reads them contiguously
+    for(size_t half=1; half<fftSize; half*=2) {
+        for(size_t k=0; k<half; k++) {
+            float angle = -pi * float(k) / float(half);
+            twiddleRe_.push_back(cos(angle));
+            twiddleIm_.push_back(sin(angle));
+        }
+    }
+
+    // log-spaced band edges between minFrequency and Nyquist, at least one bin each
+    float nyquist = sampleRate * 0.5f;
+    float binWidth = float(sampleRate) / float(fftSize);
+    size_t numBins = fftSize/2;
+    bandStart_.resize(numBands+1);
+    for(size_t b=0; b<=numBands; b++) {
+        float f = minFrequency * pow(nyquist/minFrequency, float(b)/float(numBands));
+        bandStart_[b] = min(numBins, size_t(max(1.0f, f / binWidth)));
+    }
+    for(size_t b=1; b<=numBands; b++)
+        bandStart_[b] = max(bandStart_[b], min(numBins, bandStart_[b-1]+1));
+}
+
+void SpectrumAnalyzer::addSamples(const float* samples, size_t numFrames, int channels)
+{
+    const float mix = 1.0f / float(channels);
+
+    for(size_t i=0; i<numFrames; i++) {
+        float v = 0;
+        for(int c=0; c<channels; c++)
+            v += samples[i*channels + c];
+        input_[filled_++] = v * mix;
+
+        if(filled_ == fftSize_) {
+            analyzeFrame_();
+            // keep the overlapping part for the next frame
+            memmove(input_.data(), input_.data() + hop_, (fftSize_-hop_)*sizeof(float));
+            filled_ = fftSize_ - hop_;
+        }
+    }
+}
+
+void SpectrumAnalyzer::analyzeFrame_()
+{
+    // windowed input in bit-reversed order, imaginary part zero
+    for(size_t i=0; i<fftSize_; i++) {
+        unsigned int r = bitReverse_[i];
+        re_[r] = input_[i] * window_[i];
+        im_[r] = 0.0f;
+    }
+
+    fft_();
+
+    // a full scale sine has magnitude fftSize/4 with a Hann window
+    const float norm = 4.0f / float(fftSize_);
+    for(size_t b=0; b+1<bandStart_.size(); b++) {
+        float sum = 0;
+        for(size_t k=bandStart_[b]; k<bandStart_[b+1]; k++)
+            sum += re_[k]*re_[k] + im_[k]*im_[k];
+        size_t n = bandStart_[b+1]-bandStart_[b];
+        float mag = n? sqrt(sum / float(n)) * norm : 0.0f;
+
+        // -60 ... 0 dB -> 0 ... 1
+        float db = 20.0f * log10(max(mag, 1e-6f));
+        float value = min(max((db + 60.0f) / 60.0f, 0.0f), 1.0f);
+        bands_[b] = max(value, bands_[b] * decay);
+    }
+
+    frameCount_++;
+}
+
+void SpectrumAnalyzer::fft_()
+{
+    float* re = re_.data();
+    float* im = im_.data();
+    const float* twRe = twiddleRe_.data();
+    const float* twIm = twiddleIm_.data();
+
+    // iterative radix-2 decimation in time, input already bit-reversed
+    for(size_t half=1; half<fftSize_; twRe += half, twIm += half, half*=2) {
+        for(size_t start=0; start<fftSize_; start+=2*half) {
+            float* aRe = re + start;
+            float* aIm = im + start;
+            float* bRe = aRe + half;
+            float* bIm = aIm + half;
+            size_t k = 0;
+#ifdef SPECTRUM_SSE2
+            // four butterflies at once for all but the first two stages
+            for(; k+4 <= half; k+=4) {
+                __m128 wr = _mm_loadu_ps(twRe + k);
+                __m128 wi = _mm_loadu_ps(twIm + k);
+                __m128 xr = _mm_loadu_ps(bRe + k);
+                __m128 xi = _mm_loadu_ps(bIm + k);
+                __m128 tr = _mm_sub_ps(_mm_mul_ps(wr, xr), _mm_mul_ps(wi, xi));
+                __m128 ti = _mm_add_ps(_mm_mul_ps(wr, xi), _mm_mul_ps(wi, xr));
+                __m128 ar = _mm_loadu_ps(aRe + k);
+                __m128 ai = _mm_loadu_ps(aIm + k);
+                _mm_storeu_ps(bRe + k, _mm_sub_ps(ar, tr));
+                _mm_storeu_ps(bIm + k, _mm_sub_ps(ai, ti));
+                _mm_storeu_ps(aRe + k, _mm_add_ps(ar, tr));
+                _mm_storeu_ps(aIm + k, _mm_add_ps(ai, ti));
+            }
+#endif
+            for(; k<half; k++) {
+                float tr = twRe[k]*bRe[k] - twIm[k]*bIm[k];
+                float ti = twRe[k]*bIm[k] + twIm[k]*bRe[k];
+                bRe[k] = aRe[k] - tr;
+                bIm[k] = aIm[k] - ti;
+                aRe[k] += tr;
+                aIm[k] += ti;
+            }
+        }
+    }
+}
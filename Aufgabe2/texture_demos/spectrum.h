@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+#include <stddef.h> // size_t
+
+/*
+ *  Real-time spectrum analyzer for audio input.
+ *
+ *  Samples are collected into overlapping frames (Hann window, hop of
+ *  half a frame by default). Each frame is transformed with a radix-2 FFT
+ *  and the magnitudes are binned into bands with logarithmically spaced
+ *  center frequencies, so bass and treble get roughly the same number of
+ *  bands. Band values are in dB, mapped from -60...0 dB to 0...1, with
+ *  a short decay so single frames do not flicker.
+ *
+ */
+class SpectrumAnalyzer
+{
+public:
+
+    // fftSize must be a power of two, hop <= fftSize
+    SpectrumAnalyzer(int sampleRate,
+                     size_t numBands = 64,
+                     size_t fftSize = 1024,
+                     size_t hop = 512,
+                     float minFrequency = 40.0f);
+
+    /*
+     *  Add interleaved samples in -1...1, channels are mixed down to mono.
+     *  Analyzes as many frames as become complete.
+     */
+    void addSamples(const float* samples, size_t numFrames, int channels = 1);
+
+    // band values of the latest analyzed frame, 0...1
+    const std::vector<float>& bands() const { return bands_; }
+
+    // number of frames analyzed so far
+    size_t frameCount() const { return frameCount_; }
+
+    // how quickly bands fall back after a peak (0 = no smoothing)
+    float decay = 0.7f;
+
+private:
+
+    size_t fftSize_, hop_;
+
+    // samples not yet consumed by a frame, filled up to fftSize_
+    std::vector<float> input_;
+    size_t filled_ = 0;
+
+    // precomputed window, bit reversal and twiddle factors (all stages)
+    std::vector<float> window_;
+    std::vector<unsigned int> bitReverse_;
+    std::vector<float> twiddleRe_, twiddleIm_;
+
+    // FFT work buffers (split complex)
+    std::vector<float> re_, im_;
+
+    // first FFT bin of each band, plus end of the last band
+    std::vector<size_t> bandStart_;
+
+    std::vector<float> bands_;
+    size_t frameCount_ = 0;
+
+    // window, transform and bin the current input frame
+    void analyzeFrame_();
+
+    // in-place FFT of re_/im_
+    void fft_();
+
+};
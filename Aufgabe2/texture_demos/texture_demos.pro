@@ -24,7 +24,11 @@ HEADERS      += \
     mesh/mesh.h \
     mesh/vertexbuffer.h \
     mesh/geometrybuffers.h \
-    cubemap.h
+    cubemap.h \
+    audiolevel.h \
+    audiosnapshot.h \
+    audiosource.h \
+    spectrum.h
 
 # C++ SOURCE FILES TO BE COMPILED AND LINKED TOGETHER
 SOURCES      += \
@@ -42,7 +46,10 @@ SOURCES      += \
     mesh/mesh.cpp \
     rtrglwidget.cpp \
     geometries/parametric.cpp \
-    cubemap.cpp
+    cubemap.cpp \
+    audiolevel.cpp \
+    audiosource.cpp \
+    spectrum.cpp
 
 # RESOURCE FILES TO BE PROCESSED BY QT
 RESOURCES    += \
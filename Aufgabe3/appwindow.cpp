@@ -74,6 +74,17 @@ AppWindow::AppWindow(QWidget *parent) :
             [this](int value) { scene().setSpecularScale(float(value)/20.0); } );
     connect(ui->shininessSlider, &QSlider::valueChanged,
             [this](int value) { scene().setShininess(float(value)); } );
+    connect(ui->lightingComboBox, &QComboBox::currentTextChanged,
+            [this](QString value) {
+        if(value == "Deferred")
+            scene().useDeferredLighting();
+        else if(value == "Clustered")
+            scene().useClusteredLighting();
+        else if(value == "Single pass")
+            scene().useSinglePassLighting();
+        else if(value == "Multi-pass")
+            scene().useMultiPassLighting();
+    } );
 
     // post processing parameters -------------------------------
     connect(ui->postFilterComboBox, &QComboBox::currentTextChanged,
@@ -96,6 +107,8 @@ AppWindow::AppWindow(QWidget *parent) :
         if(!value)
             hideBufferContents();
     } );
+    connect(ui->showStatsToggle, &QCheckBox::toggled,
+            [this](bool value) { scene().toggleStatistics(value); } );
     connect(ui->jitterCheckbox, &QCheckBox::toggled,[this](bool value){ scene().toggleJittering(value); });
 
     // strange cast here: see https://stackoverflow.com/questions/16794695/connecting-overloaded-signals-and-slots-in-qt-5
@@ -0,0 +1,100 @@
+/*
+ * fragment shader for the lighting pass of deferred shading
+ *
+ * Reads the surface attributes from the G-buffer (see GBuffer) and adds
+ * the Phong contribution of the lights of the pixel's cluster (see
+ * LightClusters), so the cost depends on the pixels and lights, not on
+ * the geometry of the scene.
+ *
+ */
+
+#version 150
+
+in vec2 texcoord_frag;
+
+// output: color, alpha as in textured_phong.frag for the post processing
+out vec4 outColor;
+
+// camera, time and lights, shared by all draws of a view (see FrameBlock in frameblock.h)
+struct Light {
+    vec4 position_WC;
+    vec3 intensity;
+    float radius;
+};
+layout(std140) uniform FrameBlock {
+    mat4  viewMatrix;
+    mat4  projectionMatrix;
+    mat4  viewProjectionMatrix;
+    vec4  cameraPosition_WC;
+    float time;
+    int   numLights;
+    Light lights[8];
+    vec4  clusters; // viewport size in pixels, near plane, slices per log(depth)
+};
+
+// surface attributes
+uniform sampler2D gAlbedo;   // diffuse color
+uniform sampler2D gNormal;   // normal in world coordinates, shininess
+uniform sampler2D gSpecular; // specular color
+uniform sampler2D gEmission; // ambient + emissive + environment color, view depth
+
+// all lights, and for each cluster of the view frustum the range of its
+// lights in the index list; grid size as in LightClusters
+const int clusterTilesX = 16, clusterTilesY = 8, clusterSlices = 24;
+uniform samplerBuffer clusterLights;   // per light: position_WC + radius, intensity
+uniform usamplerBuffer clusterRanges;  // per cluster: offset and count in clusterIndices
+uniform usamplerBuffer clusterIndices; // light indices
+
+float attenuation(float distance, float radius) {
+    float x = clamp(1.0 - (distance*distance)/(radius*radius), 0.0, 1.0);
+    return x*x;
+}
+
+void main() {
+
+    // no surface here, keep the background
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 emission = texelFetch(gEmission, pixel, 0);
+    float depth = emission.a;
+    if(depth <= 0.0)
+        discard;
+
+    vec3 albedo = texelFetch(gAlbedo, pixel, 0).rgb;
+    vec4 normal = texelFetch(gNormal, pixel, 0);
+    vec3 specular = texelFetch(gSpecular, pixel, 0).rgb;
+    vec3 N = normalize(normal.xyz);
+    float shininess = normal.w;
+
+    // position from the depth along the pixel's view ray, view matrix is rigid
+    vec2 ndc = gl_FragCoord.xy / clusters.xy * 2.0 - 1.0;
+    vec3 position_EC = vec3(depth * (ndc.x + projectionMatrix[2][0]) / projectionMatrix[0][0],
+                            depth * (ndc.y + projectionMatrix[2][1]) / projectionMatrix[1][1],
+                            -depth);
+    vec3 position_WC = transpose(mat3(viewMatrix)) * (position_EC - viewMatrix[3].xyz);
+    vec3 V = normalize(cameraPosition_WC.xyz - position_WC);
+
+    // cluster from the pixel position and the exponential depth slice
+    ivec3 cluster = ivec3(gl_FragCoord.xy / clusters.xy * vec2(clusterTilesX, clusterTilesY),
+                          log(depth / clusters.z) * clusters.w);
+    cluster = clamp(cluster, ivec3(0), ivec3(clusterTilesX-1, clusterTilesY-1, clusterSlices-1));
+    uvec2 range = texelFetch(clusterRanges, (cluster.z*clusterTilesY + cluster.y)*clusterTilesX + cluster.x).xy;
+
+    // Phong contribution of each light, as in textured_phong.frag
+    vec3 color = emission.rgb;
+    for(uint i=range.x; i<range.x+range.y; i++) {
+        int light = int(texelFetch(clusterIndices, int(i)).r);
+        vec4 position = texelFetch(clusterLights, 2*light);
+        vec3 toLight = position.xyz - position_WC;
+        vec3 L = normalize(toLight);
+        float ndotl = dot(N, L);
+        if(ndotl <= 0.0)
+            continue;
+        vec3 intensity = texelFetch(clusterLights, 2*light+1).rgb * attenuation(length(toLight), position.w);
+        float rdotv = max(dot(reflect(-L, N), V), 0.0);
+        color += albedo * intensity * ndotl + specular * intensity * pow(rdotv, shininess);
+    }
+
+    // clip space z, as written by the forward pass for depth of field
+    float z = projectionMatrix[2][2] * -depth + projectionMatrix[3][2];
+    outColor = vec4(color, z/10);
+}
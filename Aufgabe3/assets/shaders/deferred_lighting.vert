@@ -0,0 +1,16 @@
+/*
+ * vertex shader for the lighting pass of deferred shading:
+ * a rectangle covering the viewport, no transformation
+ *
+ */
+
+#version 150
+
+in vec4 position_MC;
+in vec2 texcoord;
+out vec2 texcoord_frag;
+
+void main(void) {
+    gl_Position = vec4(position_MC.xy, 0, 1);
+    texcoord_frag = texcoord;
+}
@@ -0,0 +1,9 @@
+/*
+ * fragment shader for the depth pre-pass: nothing but the depth
+ *
+ */
+
+#version 150
+
+void main() {
+}
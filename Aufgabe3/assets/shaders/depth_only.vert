@@ -0,0 +1,48 @@
+/*
+ * vertex shader for the depth pre-pass: positions only, transformed
+ * exactly like in textured_phong.vert, so the main pass finds the same
+ * depth values (see DepthPrePass)
+ *
+ * INSTANCED takes the model matrix from a per-instance attribute
+ *
+ */
+
+#version 150
+
+// the same depth in all programs for the same input
+invariant gl_Position;
+
+#ifdef INSTANCED
+in mat4 instanceModelMatrix;
+
+// camera, shared by all draws of a view (see FrameBlock in frameblock.h)
+struct Light {
+    vec4 position_WC;
+    vec3 intensity;
+    float radius;
+};
+layout(std140) uniform FrameBlock {
+    mat4  viewMatrix;
+    mat4  projectionMatrix;
+    mat4  viewProjectionMatrix;
+    vec4  cameraPosition_WC;
+    float time;
+    int   numLights;
+    Light lights[8];
+    vec4  clusters;
+};
+#else
+uniform mat4 modelViewProjectionMatrix;
+#endif
+
+in vec3 position_MC;
+
+void main(void) {
+
+#ifdef INSTANCED
+    mat4 modelViewMatrix = viewMatrix * instanceModelMatrix;
+    mat4 modelViewProjectionMatrix = projectionMatrix * modelViewMatrix;
+#endif
+
+    gl_Position = modelViewProjectionMatrix * vec4(position_MC,1);
+}
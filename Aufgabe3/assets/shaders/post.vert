@@ -6,8 +6,25 @@
 
 #version 150
 
-// transformation matrices as provided by RTR app
-uniform mat4 modelViewProjectionMatrix;
+// model matrix as provided by RTR app, view and projection from the FrameBlock
+uniform mat4 modelMatrix;
+
+// camera, time and lights, shared by all draws of a view (see FrameBlock in frameblock.h)
+struct Light {
+    vec4 position_WC;
+    vec3 intensity;
+    float radius;
+};
+layout(std140) uniform FrameBlock {
+    mat4  viewMatrix;
+    mat4  projectionMatrix;
+    mat4  viewProjectionMatrix;
+    vec4  cameraPosition_WC;
+    float time;
+    int   numLights;
+    Light lights[8];
+    vec4  clusters; // viewport size in pixels, near plane, slices per log(depth)
+};
 
 // tex coords
 in  vec2 texcoord;
@@ -20,7 +37,7 @@ in vec4 position_MC;
 void main(void) {
 
     // position to clip coordinates
-    gl_Position = modelViewProjectionMatrix * position_MC;
+    gl_Position = viewProjectionMatrix * modelMatrix * position_MC;
     z = gl_Position.z;
     texcoord_frag = texcoord;
 }
@@ -1,6 +1,13 @@
 /*
  * fragment shader for phong + textures + bumps
  *
+ * Optional features are compiled in by #defines (see ShaderPermutations):
+ * ENVIRONMENT_TEXTURE, DIFFUSE_TEXTURE, EMISSIVE_TEXTURE, GLOSS_TEXTURE,
+ * BUMP_MAP, DISPLACEMENT_MAP, TEXTURE_ARRAY, INSTANCED (vertex shader only),
+ * LIGHT_LOOP (all lights in one pass instead of the light of lightPass),
+ * CLUSTERED_LIGHTS (the lights of the fragment's cluster, see LightClusters),
+ * GBUFFER (surface attributes for deferred shading instead of a color, see GBuffer)
+ *
  */
 
 #version 150
@@ -11,21 +18,57 @@ in vec3 normal_EC;
 
 // output - transformed to tangent space (TS)
 in vec3 viewDir_TS;
+#if defined(LIGHT_LOOP) || defined(CLUSTERED_LIGHTS) || defined(GBUFFER)
+in vec3 position_WC;
+in mat3 TBN_WC;
+#else
 in vec3 lightDir_TS;
+in float lightDistance;
+#endif
 
 // tex coords - just copied
 in vec2 texcoord_frag;
 
 in float z;
 
-// output: color
+// output: color, or the attributes of the surface (see GBuffer)
+#ifdef GBUFFER
+out vec4 gAlbedo;
+out vec4 gNormal;
+out vec4 gSpecular;
+out vec4 gEmission;
+#else
 out vec4 outColor;
+#endif
 
-struct PointLight {
-    vec3 intensity;
+// camera, time and lights, shared by all draws of a view (see FrameBlock in frameblock.h)
+struct Light {
     vec4 position_WC;
-    int  pass;
+    vec3 intensity;
+    float radius;
 };
+layout(std140) uniform FrameBlock {
+    mat4  viewMatrix;
+    mat4  projectionMatrix;
+    mat4  viewProjectionMatrix;
+    vec4  cameraPosition_WC;
+    float time;
+    int   numLights;
+    Light lights[8];
+    vec4  clusters; // viewport size in pixels, near plane, slices per log(depth)
+};
+
+// light of the current pass
+uniform int lightPass;
+
+#ifdef CLUSTERED_LIGHTS
+// all lights, and for each cluster of the view frustum the range of its
+// lights in the index list; grid size as in LightClusters
+const int clusterTilesX = 16, clusterTilesY = 8, clusterSlices = 24;
+uniform samplerBuffer clusterLights;   // per light: position_WC + radius, intensity
+uniform usamplerBuffer clusterRanges;  // per cluster: offset and count in clusterIndices
+uniform usamplerBuffer clusterIndices; // light indices
+#endif
 
 struct PhongMaterial {
     vec3 k_ambient;
@@ -48,6 +91,7 @@ struct TexturedMaterial {
     bool useEmissiveTexture;
     bool useGlossTexture;
     float emissive_scale;
+    ivec4 layers; // diffuse, emissive, gloss, bump layer in textureArray
 };
 
 struct BumpMaterial {
@@ -61,12 +105,17 @@ struct DisplacementMaterial {
     float scale;
 };
 
-uniform PointLight light;
-uniform PhongMaterial phong;
-uniform TexturedMaterial tex;
-uniform BumpMaterial bump;
-uniform DisplacementMaterial displacement;
-uniform EnvMap envmap;
+// material parameters, from a shared uniform buffer (see TexturedPhongMaterial::Block)
+// must be declared identically in vertex and fragment shader
+layout(std140) uniform MaterialBlock {
+    PhongMaterial phong;
+    EnvMap envmap;
+    TexturedMaterial tex;
+    BumpMaterial bump;
+    DisplacementMaterial displacement;
+    vec3 ambientLightIntensity;
+};
+
 uniform samplerCube environmentTexture;
 uniform sampler2D diffuseTexture;
 uniform sampler2D emissiveTexture;
@@ -74,43 +123,69 @@ uniform sampler2D glossTexture;
 uniform sampler2D bumpTexture;
 uniform sampler2D displacementTexture;
 
-// standard uniforms
-uniform mat4  viewMatrix;
-uniform mat4  projectionMatrix;
-uniform float time;
-uniform vec3  ambientLightIntensity;
+// texture lookups, from separate textures or from layers of one array
+#ifdef TEXTURE_ARRAY
+uniform sampler2DArray textureArray;
+vec4 diffuseLookup(vec2 uv)  { return texture(textureArray, vec3(uv, tex.layers.x)); }
+vec4 emissiveLookup(vec2 uv) { return texture(textureArray, vec3(uv, tex.layers.y)); }
+vec4 glossLookup(vec2 uv)    { return texture(textureArray, vec3(uv, tex.layers.z)); }
+vec4 bumpLookup(vec2 uv)     { return texture(textureArray, vec3(uv, tex.layers.w)); }
+#else
+vec4 diffuseLookup(vec2 uv)  { return texture(diffuseTexture, uv); }
+vec4 emissiveLookup(vec2 uv) { return texture(emissiveTexture, uv); }
+vec4 glossLookup(vec2 uv)    { return texture(glossTexture, uv); }
+vec4 bumpLookup(vec2 uv)     { return texture(bumpTexture, uv); }
+#endif
 
 /*
- *  Calculate surface color based on Phong illumination model.
+ *  Calculate surface color based on Phong illumination model:
+ *  ambient / emissive part, plus the contribution of one light.
+ *  Point lights fade out smoothly towards their radius.
  */
 
-vec3 texphong(vec3 n, vec3 v, vec3 l, vec2 uv) {
+float attenuation(float distance, float radius) {
+    float x = clamp(1.0 - (distance*distance)/(radius*radius), 0.0, 1.0);
+    return x*x;
+}
 
-    // texture lookups
-    vec3  diffCol  = texture(diffuseTexture, uv).rgb;
-    vec3  emissCol = texture(emissiveTexture, uv).rgb * tex.emissive_scale;
-    float gloss    = texture(glossTexture, uv).r * 255.0; // 0...255
+vec3 texphongAmbient(vec2 uv) {
+#ifdef EMISSIVE_TEXTURE
+    return emissiveLookup(uv).rgb * tex.emissive_scale;
+#else
+    return phong.k_ambient * ambientLightIntensity;
+#endif
+}
+
+vec3 diffuseCoefficient(vec2 uv) {
+#ifdef DIFFUSE_TEXTURE
+    return diffuseLookup(uv).rgb;
+#else
+    return phong.k_diffuse;
+#endif
+}
+
+float shininessExponent(vec2 uv) {
+#ifdef GLOSS_TEXTURE
+    return glossLookup(uv).r * 255.0; // 0...255
+#else
+    return phong.shininess;
+#endif
+}
+
+vec3 texphongLight(vec3 n, vec3 v, vec3 l, vec2 uv, vec3 intensity) {
 
     // cosine of angle between light and surface normal.
     float ndotl = dot(n,l);
 
-    // ambient / emissive part
-    vec3 ambient = vec3(0,0,0);
-    if(light.pass == 0) // only add ambient in first light pass
-        ambient = tex.useEmissiveTexture?
-                  emissCol : phong.k_ambient * ambientLightIntensity;
-
     // surface back-facing to light?
     if(ndotl<=0.0)
-        return ambient;
-    else
-        ndotl = max(ndotl, 0.0);
+        return vec3(0,0,0);
 
     // diffuse contribution
-    vec3 diffuseCoeff = tex.useDiffuseTexture? diffCol : phong.k_diffuse;
+    vec3 diffuseCoeff = diffuseCoefficient(uv);
 
     // final diffuse term for daytime
-    vec3 diffuse =  diffuseCoeff * light.intensity * ndotl;
+    vec3 diffuse =  diffuseCoeff * intensity * ndotl;
 
     // reflected light direction = perfect reflection direction
     vec3 r = reflect(-l,n);
@@ -119,11 +194,11 @@ vec3 texphong(vec3 n, vec3 v, vec3 l, vec2 uv) {
     float rdotv = max( dot(r,v), 0.0);
 
     // specular contribution + gloss map
-    float shininess = tex.useGlossTexture? gloss : phong.shininess;
-    vec3 specular = phong.k_specular * light.intensity * pow(rdotv, shininess);
+    float shininess = shininessExponent(uv);
+    vec3 specular = phong.k_specular * intensity * pow(rdotv, shininess);
 
     // return sum of all contributions
-    return ambient + diffuse + specular;
+    return diffuse + specular;
 
 }
 
@@ -133,17 +208,54 @@ vec3 decodeNormal(vec3 normal) {
 
 void main() {
 
+    // get bump direction (in tangent space) from bump texture,
     // default normal in tangent space is (0,0,1).
-    vec3 bumpValue = texture(bumpTexture, texcoord_frag).xyz;
-
-    // get bump direction (in tangent space) from bump texture
-    vec3 N = bump.use? decodeNormal(bumpValue) : vec3(0,0,1);
+#ifdef BUMP_MAP
+    vec3 N = decodeNormal(bumpLookup(texcoord_frag).xyz);
+#else
+    vec3 N = vec3(0,0,1);
+#endif
     vec3 V = normalize(viewDir_TS);
-    vec3 L = normalize(lightDir_TS);
 
     // calculate color using phong illumination
-    vec3 final_color = texphong(N, V, L, texcoord_frag);
+#if defined(GBUFFER)
+    // only the ambient part here, the lights are added in screen space
+    vec3 final_color = texphongAmbient(texcoord_frag);
+#elif defined(CLUSTERED_LIGHTS)
+    // cluster from the pixel position and the exponential depth slice
+    ivec3 cluster = ivec3(gl_FragCoord.xy / clusters.xy * vec2(clusterTilesX, clusterTilesY),
+                          log(-position_EC.z / clusters.z) * clusters.w);
+    cluster = clamp(cluster, ivec3(0), ivec3(clusterTilesX-1, clusterTilesY-1, clusterSlices-1));
+    uvec2 range = texelFetch(clusterRanges, (cluster.z*clusterTilesY + cluster.y)*clusterTilesX + cluster.x).xy;
+
+    vec3 final_color = texphongAmbient(texcoord_frag);
+    for(uint i=range.x; i<range.x+range.y; i++) {
+        int light = int(texelFetch(clusterIndices, int(i)).r);
+        vec4 position = texelFetch(clusterLights, 2*light);
+        vec3 intensity = texelFetch(clusterLights, 2*light+1).rgb;
+        vec3 toLight = position.xyz - position_WC;
+        vec3 L = normalize(toLight * TBN_WC);
+        final_color += texphongLight(N, V, L, texcoord_frag,
+                                     intensity * attenuation(length(toLight), position.w));
+    }
+#elif defined(LIGHT_LOOP)
+    vec3 final_color = texphongAmbient(texcoord_frag);
+    for(int i=0; i<numLights; i++) {
+        vec3 toLight = lights[i].position_WC.xyz - position_WC;
+        vec3 L = normalize(toLight * TBN_WC);
+        final_color += texphongLight(N, V, L, texcoord_frag,
+                                     lights[i].intensity * attenuation(length(toLight), lights[i].radius));
+    }
+#else
+    // only add ambient in first light pass
+    vec3 L = normalize(lightDir_TS);
+    vec3 final_color = texphongLight(N, V, L, texcoord_frag,
+                                     lights[lightPass].intensity * attenuation(lightDistance, lights[lightPass].radius));
+    if(lightPass == 0)
+        final_color += texphongAmbient(texcoord_frag);
+#endif
 
+#ifdef ENVIRONMENT_TEXTURE
     // calculate reflection of environment
     vec3 normalEC = normalize(normal_EC);
     vec3 viewdirEC = normalize(-position_EC.xyz);
@@ -155,9 +267,16 @@ void main() {
     vec3 refrWC = (inverse(viewMatrix) * vec4(refrEC,0.0)).xyz;
     vec3 c_refract = envmap.k_refract * texture(environmentTexture, refrWC).rgb;
 
-    if(envmap.useEnvironmentTexture)
-        final_color += c_mirror + c_refract;
+    final_color += c_mirror + c_refract;
+#endif
 
+#ifdef GBUFFER
+    gAlbedo = vec4(diffuseCoefficient(texcoord_frag), 1);
+    gNormal = vec4(normalize(TBN_WC * N), shininessExponent(texcoord_frag));
+    gSpecular = vec4(phong.k_specular, 1);
+    gEmission = vec4(final_color, -position_EC.z);
+#else
     outColor = vec4(final_color, z/10);
+#endif
 
 }
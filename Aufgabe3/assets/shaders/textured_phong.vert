@@ -1,18 +1,45 @@
 /*
  *
- * vertex shader for phong + textures + bumps 
+ * vertex shader for phong + textures + bumps
+ *
+ * DISPLACEMENT_MAP compiles in displacement mapping, INSTANCED takes the
+ * model matrix from a per-instance attribute, LIGHT_LOOP, CLUSTERED_LIGHTS and
+ * GBUFFER pass what the fragment shader needs to shade many lights (see
+ * ShaderPermutations)
  *
  */
 
 #version 150
 
+// the same depth as in the depth pre-pass (depth_only.vert)
+invariant gl_Position;
+
 // transformation matrices
+#ifdef INSTANCED
+in mat4 instanceModelMatrix;
+#else
 uniform mat4 modelViewProjectionMatrix;
-uniform mat4 projectionMatrix;
 uniform mat4 modelViewMatrix;
-uniform mat4 viewMatrix;
 uniform mat4 modelMatrix;
 uniform mat3 normalMatrix;
+#endif
+
+// camera, time and lights, shared by all draws of a view (see FrameBlock in frameblock.h)
+struct Light {
+    vec4 position_WC;
+    vec3 intensity;
+    float radius;
+};
+layout(std140) uniform FrameBlock {
+    mat4  viewMatrix;
+    mat4  projectionMatrix;
+    mat4  viewProjectionMatrix;
+    vec4  cameraPosition_WC;
+    float time;
+    int   numLights;
+    Light lights[8];
+    vec4  clusters; // viewport size in pixels, near plane, slices per log(depth)
+};
 
 // in: position and normal vector in model coordinates (_MC)
 in vec3 position_MC;
@@ -21,19 +48,54 @@ in vec3 tangent_MC;
 in vec3 bitangent_MC;
 in vec2 texcoord;
 
-// point light
-struct PointLight {
-    vec3 intensity;
-    vec4 position_WC;
-    int  pass;
+// light of the current pass
+uniform int lightPass;
+
+struct PhongMaterial {
+    vec3 k_ambient;
+    vec3 k_diffuse;
+    vec3 k_specular;
+    float shininess;
+    bool debug_texcoords;
+
+};
+
+struct EnvMap {
+    bool useEnvironmentTexture;
+    vec3 k_mirror;
+    vec3 k_refract;
+    float refract_ratio;
+};
+
+struct TexturedMaterial {
+    bool useDiffuseTexture;
+    bool useEmissiveTexture;
+    bool useGlossTexture;
+    float emissive_scale;
+    ivec4 layers; // diffuse, emissive, gloss, bump layer in textureArray
+};
+
+struct BumpMaterial {
+    bool use;
+    bool debug;
+    float scale;
 };
-uniform PointLight light;
 
 struct DisplacementMaterial {
     bool use;
     float scale;
 };
-uniform DisplacementMaterial displacement;
+
+// material parameters, from a shared uniform buffer (see TexturedPhongMaterial::Block)
+// must be declared identically in vertex and fragment shader
+layout(std140) uniform MaterialBlock {
+    PhongMaterial phong;
+    EnvMap envmap;
+    TexturedMaterial tex;
+    BumpMaterial bump;
+    DisplacementMaterial displacement;
+    vec3 ambientLightIntensity;
+};
 uniform sampler2D displacementTexture;
 
 // output - transformed to eye coordinates (EC)
@@ -42,7 +104,14 @@ out vec3 normal_EC;
 
 // output - transformed to tangent space (TS)
 out vec3 viewDir_TS;
+#if defined(LIGHT_LOOP) || defined(CLUSTERED_LIGHTS) || defined(GBUFFER)
+// position and tangent space in world coordinates, light directions per fragment
+out vec3 position_WC;
+out mat3 TBN_WC;
+#else
 out vec3 lightDir_TS;
+out float lightDistance;
+#endif
 
 out float z;
 
@@ -52,12 +121,21 @@ out vec2 texcoord_frag;
 
 void main(void) {
 
-    // displacement mapping!
-    float disp = texture(displacementTexture, texcoord).r * displacement.scale;
+#ifdef INSTANCED
+    // per instance, instead of the uniforms set by Camera::setMatrices()
+    mat4 modelMatrix = instanceModelMatrix;
+    mat4 modelViewMatrix = viewMatrix * modelMatrix;
+    mat4 modelViewProjectionMatrix = projectionMatrix * modelViewMatrix;
+    mat3 normalMatrix = transpose(inverse(mat3(modelViewMatrix)));
+#endif
+
     vec4 pos = vec4(position_MC,1);
 
-    if(displacement.use)
-        pos += vec4(normal_MC,0)*disp;
+#ifdef DISPLACEMENT_MAP
+    // displacement mapping!
+    float disp = texture(displacementTexture, texcoord).r * displacement.scale;
+    pos += vec4(normal_MC,0)*disp;
+#endif
 
     // vertex/fragment position in clip coordinates
     gl_Position  = modelViewProjectionMatrix * pos;
@@ -72,23 +150,26 @@ void main(void) {
     texcoord_frag = texcoord;
 
     // calculate position and T N B in world coordinates
-    mat4 viewMatrixInverse = inverse(viewMatrix);
     vec4 wcPosition      = modelMatrix*vec4(position_MC,1.0);
-    vec4 wcEyePosition   = viewMatrixInverse*vec4(0,0,0,1); // only works for perspective projection
-    // vec4 wcLightPosition = viewMatrixInverse*light.position_EC;
-    vec4 wcLightPosition = light.position_WC;
+    vec4 wcEyePosition   = cameraPosition_WC; // only works for perspective projection
     vec3 wcNormal        = (modelMatrix*vec4(normal_MC, 0)).xyz;
     vec3 wcTangent       = (modelMatrix*vec4(tangent_MC, 0)).xyz;
     vec3 wcBitangent     = (modelMatrix*vec4(bitangent_MC, 0)).xyz;
 
-    // light and view dir in WC
-    vec3 wcLightDir = wcLightPosition.xyz - wcPosition.xyz;
+    // view dir in WC
     vec3 wcViewDir = wcEyePosition.xyz - wcPosition.xyz; // only for perspective!
 
     // now convert to TS
     mat3 TBN = mat3(wcTangent, wcBitangent, wcNormal);
-    lightDir_TS = wcLightDir * TBN;
     viewDir_TS  = wcViewDir * TBN;
+#if defined(LIGHT_LOOP) || defined(CLUSTERED_LIGHTS) || defined(GBUFFER)
+    position_WC = wcPosition.xyz;
+    TBN_WC = TBN;
+#else
+    vec3 wcLightDir = lights[lightPass].position_WC.xyz - wcPosition.xyz;
+    lightDir_TS = wcLightDir * TBN;
+    lightDistance = length(wcLightDir);
+#endif
     z = gl_Position.z;
 
 }
@@ -1,6 +1,10 @@
 #include "camera.h"
+#include "glstatecache.h"
 #include <assert.h>
 
+#include <algorithm> // std::equal
+#include <functional> // std::hash
+
 using namespace std;
 
 Camera::Camera()
@@ -13,18 +17,23 @@ Camera::Camera()
 void Camera::setMatrices(Material &material,
                          QMatrix4x4 modelMatrix) const
 {
+    material.selectProgram();
     auto& prog = material.program();
 
     QMatrix4x4 mv  = viewMatrix_ * modelMatrix;
     QMatrix4x4 mvp = projectionMatrix_ * mv;
 
-    prog.bind();
-    prog.setUniformValue(name_m_.c_str(),   modelMatrix);
-    prog.setUniformValue(name_v_.c_str(),   viewMatrix_);
-    prog.setUniformValue(name_p_.c_str(),   projectionMatrix_);
-    prog.setUniformValue(name_mv_.c_str(),  mv);
-    prog.setUniformValue(name_n_.c_str(),   mv.normalMatrix());
-    prog.setUniformValue(name_mvp_.c_str(), mvp);
+    const int* location = material.matrixLocations(namesKey_, names_);
+
+    // programs using the FrameBlock get view and projection from there,
+    // so only matrices the program actually declares are sent
+    GLStateCache::current().useProgram(prog);
+    if(location[0] >= 0) prog.setUniformValue(location[0], modelMatrix);
+    if(location[1] >= 0) prog.setUniformValue(location[1], viewMatrix_);
+    if(location[2] >= 0) prog.setUniformValue(location[2], projectionMatrix_);
+    if(location[3] >= 0) prog.setUniformValue(location[3], mv);
+    if(location[4] >= 0) prog.setUniformValue(location[4], mv.normalMatrix());
+    if(location[5] >= 0) prog.setUniformValue(location[5], mvp);
 
     // qDebug() << "mvp =" << mvp;
 
@@ -39,12 +48,23 @@ void Camera::setMatrixUniformNames(const string m,
                                    const string n,
                                    const string mvp)
 {
-    name_m_   = m;
-    name_v_   = v;
-    name_p_   = p;
-    name_mv_  = mv;
-    name_n_   = n;
-    name_mvp_ = mvp;
+    names_[0] = m;
+    names_[1] = v;
+    names_[2] = p;
+    names_[3] = mv;
+    names_[4] = n;
+    names_[5] = mvp;
+
+    static const string defaultNames[6] = {
+        "modelMatrix", "viewMatrix", "projectionMatrix",
+        "modelViewMatrix", "normalMatrix", "modelViewProjectionMatrix"
+    };
+    if(equal(names_, names_+6, defaultNames)) {
+        namesKey_ = 0;
+    } else {
+        // hash of all names, never 0
+        namesKey_ = hash<string>()(m+'|'+v+'|'+p+'|'+mv+'|'+n+'|'+mvp) | 1;
+    }
 }
 
 
@@ -29,6 +29,7 @@ public:
      *  Always apply before rendering the actual objects.
      *
      *  Uniform names: see setMatrixUniformNames()
+     *  The uniform locations are looked up only once per material.
      *
      */
     void setMatrices(Material& material,
@@ -51,8 +52,12 @@ protected:
     QMatrix4x4 viewMatrix_;
     QMatrix4x4 projectionMatrix_;
 
-    // uniform names for the affected matrices
-    std::string name_m_, name_v_, name_p_, name_mv_, name_n_, name_mvp_;
+    // uniform names for the affected matrices, in the order m, v, p, mv, n, mvp
+    std::string names_[6];
+
+    // identifies the set of names for the location cache in the material,
+    // 0 for the default names so that all cameras share one cache entry
+    size_t namesKey_ = 0;
 
 };
 
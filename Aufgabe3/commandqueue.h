@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>  // std::this_thread::yield
+#include <utility> // std::move
+#include <vector>
+
+/*
+ *  Commands from one thread (the GUI) to be run on another (the render
+ *  thread), e.g. changes of materials or nodes.
+ *
+ *  A fixed-size ring buffer without locks: exactly one thread may
+ *  push(), exactly one other thread may execute(). head_ is only
+ *  written by the consumer, tail_ only by the producer.
+ *
+ */
+class CommandQueue
+{
+public:
+
+    explicit CommandQueue(size_t capacity = 1024) : ring_(capacity + 1) {}
+
+    // producer: append a command, waiting while the queue is full
+    void push(std::function<void()> command) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % ring_.size();
+        while(next == head_.load(std::memory_order_acquire))
+            std::this_thread::yield();
+        ring_[tail] = std::move(command);
+        tail_.store(next, std::memory_order_release);
+    }
+
+    // consumer: run all commands pushed so far, in order
+    void execute() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        const size_t tail = tail_.load(std::memory_order_acquire);
+        while(head != tail) {
+            std::function<void()> command = std::move(ring_[head]);
+            ring_[head] = nullptr;
+            head = (head + 1) % ring_.size();
+            head_.store(head, std::memory_order_release);
+            command();
+        }
+    }
+
+private:
+
+    std::vector<std::function<void()>> ring_;
+    std::atomic<size_t> head_{0}, tail_{0};
+};
@@ -0,0 +1,85 @@
+#include "depthprepass.h"
+#include "glstatecache.h"
+#include "renderqueue.h"
+
+#include <QOpenGLContext>
+
+using namespace std;
+
+DepthPrePass::DepthPrePass(shared_ptr<ShaderPermutations> permutations)
+    : material_(permutations)
+{
+    initializeOpenGLFunctions();
+    glGenQueries(NumModes, queries_);
+}
+
+DepthPrePass::~DepthPrePass()
+{
+    // the queries go with the context, if it is gone already
+    if(QOpenGLContext::currentContext())
+        glDeleteQueries(NumModes, queries_);
+}
+
+void DepthPrePass::collect_()
+{
+    // results of earlier frames, only if there already
+    for(int m=0; m<NumModes; m++) {
+        if(!pending_[m])
+            continue;
+        GLuint available = 0;
+        glGetQueryObjectuiv(queries_[m], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available)
+            continue;
+        glGetQueryObjectuiv(queries_[m], GL_QUERY_RESULT, &samples_[m]);
+        pending_[m] = false;
+        measured_[m] = true;
+    }
+
+    // with the pre-pass each visible pixel is shaded once
+    if(measured_[Without] && measured_[With] && samples_[With]) {
+        overdraw_ = float(samples_[Without]) / float(samples_[With]);
+        usePrePass_ = overdraw_ > threshold;
+    }
+}
+
+bool DepthPrePass::begin()
+{
+    collect_();
+
+    // first measure both modes, then draw the better one and
+    // the other one every probeInterval frames
+    bool probe = ++frame_ % probeInterval == 0;
+    if(!measured_[Without] && !pending_[Without])
+        active_ = false;
+    else if(!measured_[With] && !pending_[With])
+        active_ = true;
+    else
+        active_ = probe != usePrePass_;
+
+    // one query per mode in flight
+    measure_ = !pending_[active_? With : Without];
+    return active_;
+}
+
+bool DepthPrePass::draw(RenderQueue& queue, const Camera& camera)
+{
+    GLStateCache& gl = GLStateCache::current();
+    gl.colorMask(false);
+    bool complete = queue.submitPositions(Material::OpaquePass, camera, material_);
+    gl.colorMask(true);
+    return complete;
+}
+
+void DepthPrePass::beginSamples()
+{
+    if(measure_)
+        glBeginQuery(GL_SAMPLES_PASSED, queries_[active_? With : Without]);
+}
+
+void DepthPrePass::endSamples()
+{
+    if(!measure_)
+        return;
+    glEndQuery(GL_SAMPLES_PASSED);
+    pending_[active_? With : Without] = true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <QOpenGLExtraFunctions>
+
+#include "material.h"
+
+#include <memory> // std::shared_ptr
+
+class Camera;
+class RenderQueue;
+
+/*
+ *  Optional depth-only pass before the opaque objects, so the expensive
+ *  fragment shader of the main pass runs only once per pixel: the pre-pass
+ *  fills the depth buffer with positions only and a trivial program, the
+ *  main pass then tests with GL_EQUAL and does not write depth.
+ *
+ *  Whether this pays off depends on the overdraw, so it is measured:
+ *  occlusion queries count the samples shaded in the main pass, once with
+ *  and once without the pre-pass. Their ratio is the overdraw of the
+ *  front-to-back sorted scene. The mode with fewer samples (plus a margin
+ *  for the cost of the pre-pass) is kept, and every probeInterval frames
+ *  the other one is drawn once to measure again.
+ *
+ *  The query results are picked up a few frames later, never waiting.
+ *
+ */
+class DepthPrePass : protected QOpenGLExtraFunctions
+{
+public:
+
+    // frames between two measurements of the mode not in use
+    static const int probeInterval = 60;
+
+    // overdraw above which the pre-pass is used
+    static constexpr float threshold = 1.3f;
+
+    // permutations of depth_only with the single feature INSTANCED
+    DepthPrePass(std::shared_ptr<ShaderPermutations> permutations);
+    ~DepthPrePass();
+
+    // decide for this frame, call once before drawing the opaque objects;
+    // returns true if the pre-pass is to be drawn
+    bool begin();
+
+    // draw the depth of all opaque objects, color writes off; returns false
+    // if some meshes were left out (see RenderQueue::submitPositions), then
+    // the main pass must still write depth and test with GL_LEQUAL
+    bool draw(RenderQueue& queue, const Camera& camera);
+
+    // count the samples of the main pass in between
+    void beginSamples();
+    void endSamples();
+
+    // last measured overdraw, 0 if not known yet
+    float overdraw() const { return overdraw_; }
+
+    // is the pre-pass drawn in this frame?
+    bool active() const { return active_; }
+
+private:
+
+    DepthOnlyMaterial material_;
+
+    // samples of the main pass without / with the pre-pass
+    enum Mode { Without = 0, With, NumModes };
+    GLuint queries_[NumModes] = {0, 0};
+    bool pending_[NumModes] = {false, false};
+    GLuint samples_[NumModes] = {0, 0};
+    bool measured_[NumModes] = {false, false};
+
+    // mode of this frame, and whether its query is to be issued
+    bool active_ = false, measure_ = false;
+    bool usePrePass_ = false;
+    int frame_ = 0;
+    float overdraw_ = 0;
+
+    void collect_();
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <QOpenGLFunctions>
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include <string.h> // memcpy
+
+/*
+ *  Uniforms shared by all draws of one view in a frame: camera matrices,
+ *  animation time, the first few lights and the parameters of the light
+ *  clusters (see LightClusters). Filled and uploaded once per frame and view,
+ *  and bound to a fixed binding point that every program uses.
+ *
+ *  std140 layout of FrameBlock in textured_phong.vert/.frag and post.vert.
+ *
+ */
+struct FrameBlock
+{
+    static const GLuint binding = 0;
+    static const int maxLights = 8;
+
+    float viewMatrix[16];
+    float projectionMatrix[16];
+    float viewProjectionMatrix[16];
+    float cameraPosition_WC[4];
+    float time = 0;
+    GLint numLights = 0;
+    float pad0[2];
+    struct Light {
+        float position_WC[4];
+        float intensity[3];
+        float radius;
+    } lights[maxLights];
+
+    // viewport size in pixels, near plane, slices per unit of log(depth)
+    float clusters[4] = {1, 1, 1, 0};
+
+    void setCamera(const QMatrix4x4& view, const QMatrix4x4& projection) {
+        QMatrix4x4 viewProjection = projection * view;
+        memcpy(viewMatrix, view.constData(), sizeof(viewMatrix));
+        memcpy(projectionMatrix, projection.constData(), sizeof(projectionMatrix));
+        memcpy(viewProjectionMatrix, viewProjection.constData(), sizeof(viewProjectionMatrix));
+        QVector3D eye = view.inverted() * QVector3D(0,0,0);
+        cameraPosition_WC[0] = eye.x(); cameraPosition_WC[1] = eye.y();
+        cameraPosition_WC[2] = eye.z(); cameraPosition_WC[3] = 1;
+    }
+
+    // returns false if there is no room for more lights
+    bool addLight(const QVector3D& position_WC, const QVector3D& intensity, float radius) {
+        if(numLights >= maxLights)
+            return false;
+        Light& l = lights[numLights++];
+        l.position_WC[0] = position_WC.x(); l.position_WC[1] = position_WC.y();
+        l.position_WC[2] = position_WC.z(); l.position_WC[3] = 1;
+        l.intensity[0] = intensity.x(); l.intensity[1] = intensity.y(); l.intensity[2] = intensity.z();
+        l.radius = radius;
+        return true;
+    }
+
+    void setClusters(float width, float height, float nearPlane, float sliceScale) {
+        clusters[0] = width; clusters[1] = height;
+        clusters[2] = nearPlane; clusters[3] = sliceScale;
+    }
+};
+
+static_assert(sizeof(FrameBlock) == 496, "FrameBlock must match the std140 layout in the shaders");
@@ -0,0 +1,63 @@
+#include "frustum.h"
+
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FRUSTUM_SSE2
+#endif
+
+Frustum::Frustum(const QMatrix4x4& viewProjection)
+{
+    // left, right, bottom, top, near, far: row 3 +/- rows 0, 1, 2
+    QVector4D r3 = viewProjection.row(3);
+    QVector4D planes[6];
+    for(int i=0; i<3; i++) {
+        QVector4D r = viewProjection.row(i);
+        planes[2*i]   = r3 + r;
+        planes[2*i+1] = r3 - r;
+    }
+
+    for(int i=0; i<8; i++) {
+        QVector4D p = i < 6? planes[i] : QVector4D(0,0,0,1); // padding: always inside
+        nx_[i] = p.x(); ny_[i] = p.y(); nz_[i] = p.z(); d_[i] = p.w();
+        ax_[i] = fabsf(p.x()); ay_[i] = fabsf(p.y()); az_[i] = fabsf(p.z());
+    }
+}
+
+bool Frustum::intersects(const float boxMin[3], const float boxMax[3]) const
+{
+    // box center and half extent; the box is outside a plane if even its
+    // corner farthest along the plane normal is behind the plane:
+    // n.c + d + |n|.e < 0
+    float c[3], e[3];
+    for(int k=0; k<3; k++) {
+        c[k] = 0.5f * (boxMin[k] + boxMax[k]);
+        e[k] = 0.5f * (boxMax[k] - boxMin[k]);
+    }
+
+#ifdef FRUSTUM_SSE2
+    __m128 cx = _mm_set1_ps(c[0]), cy = _mm_set1_ps(c[1]), cz = _mm_set1_ps(c[2]);
+    __m128 ex = _mm_set1_ps(e[0]), ey = _mm_set1_ps(e[1]), ez = _mm_set1_ps(e[2]);
+    __m128 outside = _mm_setzero_ps();
+    for(int i=0; i<8; i+=4) {
+        __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(nx_+i), cx),
+                                            _mm_mul_ps(_mm_load_ps(ny_+i), cy)),
+                                 _mm_add_ps(_mm_mul_ps(_mm_load_ps(nz_+i), cz),
+                                            _mm_load_ps(d_+i)));
+        __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(ax_+i), ex),
+                                              _mm_mul_ps(_mm_load_ps(ay_+i), ey)),
+                                   _mm_mul_ps(_mm_load_ps(az_+i), ez));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps()));
+    }
+    return _mm_movemask_ps(outside) == 0;
+#else
+    for(int i=0; i<6; i++) {
+        float dist = nx_[i]*c[0] + ny_[i]*c[1] + nz_[i]*c[2] + d_[i];
+        float radius = ax_[i]*e[0] + ay_[i]*e[1] + az_[i]*e[2];
+        if(dist + radius < 0)
+            return false;
+    }
+    return true;
+#endif
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QMatrix4x4>
+
+/*
+ *  The six clipping planes of a camera, extracted from its
+ *  view-projection matrix (Gribb/Hartmann), for visibility tests of
+ *  axis-aligned boxes in world coordinates.
+ *
+ *  The planes are stored component-wise in groups of four (the last two
+ *  slots never reject anything), so a box is tested against four planes
+ *  at a time with SSE.
+ *
+ */
+class Frustum
+{
+public:
+
+    explicit Frustum(const QMatrix4x4& viewProjection);
+
+    // false if the box lies completely outside one of the planes
+    bool intersects(const float boxMin[3], const float boxMax[3]) const;
+
+private:
+
+    // plane i: nx[i]*x + ny[i]*y + nz[i]*z + d[i] >= 0 inside, plus |n| for the box extent
+    alignas(16) float nx_[8], ny_[8], nz_[8], d_[8];
+    alignas(16) float ax_[8], ay_[8], az_[8];
+};
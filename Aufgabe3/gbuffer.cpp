@@ -0,0 +1,63 @@
+#include "gbuffer.h"
+#include "glstatecache.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFunctions_3_2_Core>
+#include <QOpenGLShaderProgram>
+
+static const char* const outputNames[GBuffer::NumAttachments] = {
+    "gAlbedo", "gNormal", "gSpecular", "gEmission"
+};
+
+void GBuffer::bindOutputLocations(QOpenGLShaderProgram& prog)
+{
+    // glBindFragDataLocation is desktop OpenGL only
+    auto f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+    if(!f || !f->initializeOpenGLFunctions())
+        qFatal("GBuffer: OpenGL 3.2 core functions not available");
+    if(!prog.programId())
+        prog.create();
+    for(GLuint i=0; i<NumAttachments; i++)
+        f->glBindFragDataLocation(prog.programId(), i, outputNames[i]);
+}
+
+GBuffer::GBuffer(const QSize& size)
+{
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::Depth);
+    format.setInternalTextureFormat(GL_RGBA8);
+    fbo_.reset(new QOpenGLFramebufferObject(size, format));
+    fbo_->addColorAttachment(size, GL_RGBA16F);
+    fbo_->addColorAttachment(size, GL_RGBA8);
+    fbo_->addColorAttachment(size, GL_RGBA32F);
+
+    // the draw buffers are state of the FBO, set once; Qt has changed the
+    // framebuffer binding behind the state cache's back anyway
+    static const GLenum buffers[NumAttachments] = {
+        GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3
+    };
+    QOpenGLExtraFunctions* f = QOpenGLContext::currentContext()->extraFunctions();
+    f->glBindFramebuffer(GL_FRAMEBUFFER, fbo_->handle());
+    f->glDrawBuffers(NumAttachments, buffers);
+    GLStateCache::current().invalidate();
+}
+
+void GBuffer::bind()
+{
+    GLStateCache::current().bindFramebuffer(fbo_->handle());
+}
+
+void GBuffer::blitDepth(GLuint target)
+{
+    QOpenGLExtraFunctions* f = QOpenGLContext::currentContext()->extraFunctions();
+    QSize s = fbo_->size();
+    f->glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo_->handle());
+    f->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+    f->glBlitFramebuffer(0, 0, s.width(), s.height(), 0, 0, s.width(), s.height(),
+                         GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    // both bindings back to the target, as the state cache expects it
+    f->glBindFramebuffer(GL_FRAMEBUFFER, target);
+    GLStateCache::current().bindFramebuffer(target);
+}
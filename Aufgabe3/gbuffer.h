@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QOpenGLFramebufferObject>
+#include <QSize>
+
+#include <memory> // std::unique_ptr
+
+class QOpenGLShaderProgram;
+
+/*
+ *  Geometry buffer for deferred shading: an FBO with one texture per
+ *  surface attribute, written by the GBUFFER permutation of
+ *  textured_phong.frag and read by deferred_lighting.frag.
+ *
+ *  Albedo:   diffuse color (RGBA8)
+ *  Normal:   normal in world coordinates, shininess (RGBA16F)
+ *  Specular: specular color (RGBA8)
+ *  Emission: ambient, emissive and environment color, plus the view
+ *            depth (distance in front of the camera, 0 = no surface) (RGBA32F)
+ *
+ *  The depth buffer is a renderbuffer, like the one of the scene FBO,
+ *  so it can be copied over for drawing the sky box (see blitDepth).
+ *
+ */
+class GBuffer
+{
+public:
+
+    enum Attachment { Albedo = 0, Normal, Specular, Emission, NumAttachments };
+
+    // fragment shader outputs gAlbedo, gNormal, gSpecular, gEmission go to
+    // the attachments of the same index; call before linking a program
+    static void bindOutputLocations(QOpenGLShaderProgram& prog);
+
+    GBuffer(const QSize& size);
+
+    // bind the FBO, drawing into all attachments
+    void bind();
+
+    // texture of an attachment
+    GLuint texture(Attachment attachment) const { return fbo_->textures()[attachment]; }
+
+    // copy the depth buffer into another FBO of the same size, which is then bound
+    void blitDepth(GLuint target);
+
+    QSize size() const { return fbo_->size(); }
+
+private:
+    std::unique_ptr<QOpenGLFramebufferObject> fbo_;
+};
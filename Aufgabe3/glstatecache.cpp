@@ -0,0 +1,148 @@
+#include "glstatecache.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QOpenGLVertexArrayObject>
+
+#include <assert.h>
+#include <map>
+#include <memory> // std::unique_ptr
+
+using namespace std;
+
+GLStateCache& GLStateCache::current()
+{
+    static map<QOpenGLContext*, unique_ptr<GLStateCache>> caches;
+
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    assert(context);
+
+    auto& cache = caches[context];
+    if(!cache) {
+        cache.reset(new GLStateCache(context));
+        QObject::connect(context, &QOpenGLContext::aboutToBeDestroyed,
+                         [context] { caches.erase(context); });
+    }
+    return *cache;
+}
+
+GLStateCache::GLStateCache(QOpenGLContext* context)
+    : QOpenGLExtraFunctions(context)
+{
+    invalidate();
+}
+
+void GLStateCache::invalidate()
+{
+    program_ = Unknown;
+    activeUnit_ = Unknown;
+    for(int i=0; i<MaxTextureUnits; i++)
+        textureTarget_[i] = texture_[i] = Unknown;
+    vao_ = Unknown;
+    fbo_ = Unknown;
+    for(int i=0; i<NumCapabilities; i++)
+        enabled_[i] = Unknown;
+    depthFunc_ = Unknown;
+    blendSrc_ = blendDst_ = Unknown;
+    depthMask_ = colorMask_ = Unknown;
+}
+
+void GLStateCache::useProgram(QOpenGLShaderProgram& prog)
+{
+    if(changed_(program_, prog.programId()))
+        prog.bind();
+}
+
+void GLStateCache::bindTexture(int unit, GLenum target, GLuint texture)
+{
+    assert(unit >= 0 && unit < MaxTextureUnits);
+
+    // a unit holds one binding per target; only the last one is shadowed
+    if(textureTarget_[unit] == target && texture_[unit] == texture) {
+        counters_.elided++;
+        return;
+    }
+    textureTarget_[unit] = target;
+    texture_[unit] = texture;
+    counters_.issued++;
+
+    if(changed_(activeUnit_, GLuint(unit)))
+        glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(target, texture);
+}
+
+void GLStateCache::bindTexture(int unit, QOpenGLTexture& texture)
+{
+    bindTexture(unit, texture.target(), texture.textureId());
+}
+
+void GLStateCache::bindVertexArray(GLuint vao)
+{
+    if(changed_(vao_, vao))
+        glBindVertexArray(vao);
+}
+
+void GLStateCache::bindVertexArray(QOpenGLVertexArrayObject& vao)
+{
+    bindVertexArray(vao.objectId());
+}
+
+void GLStateCache::bindFramebuffer(GLuint fbo)
+{
+    if(changed_(fbo_, fbo))
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+}
+
+void GLStateCache::enable(GLenum cap, bool on)
+{
+    int index;
+    switch(cap) {
+    case GL_DEPTH_TEST:   index = DepthTest; break;
+    case GL_BLEND:        index = Blend; break;
+    case GL_CULL_FACE:    index = CullFace; break;
+    case GL_SCISSOR_TEST: index = ScissorTest; break;
+    default:
+        qFatal("GLStateCache: capability 0x%x is not tracked", cap);
+        return;
+    }
+
+    if(changed_(enabled_[index], on)) {
+        if(on)
+            glEnable(cap);
+        else
+            glDisable(cap);
+    }
+}
+
+void GLStateCache::depthFunc(GLenum func)
+{
+    if(changed_(depthFunc_, func))
+        glDepthFunc(func);
+}
+
+void GLStateCache::blendFunc(GLenum src, GLenum dst)
+{
+    if(blendSrc_ == src && blendDst_ == dst) {
+        counters_.elided++;
+        return;
+    }
+    blendSrc_ = src;
+    blendDst_ = dst;
+    counters_.issued++;
+    glBlendFunc(src, dst);
+}
+
+void GLStateCache::depthMask(bool on)
+{
+    if(changed_(depthMask_, on))
+        glDepthMask(on? GL_TRUE : GL_FALSE);
+}
+
+void GLStateCache::colorMask(bool on)
+{
+    if(changed_(colorMask_, on)) {
+        GLboolean mask = on? GL_TRUE : GL_FALSE;
+        glColorMask(mask, mask, mask, mask);
+    }
+}
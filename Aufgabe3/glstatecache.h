@@ -0,0 +1,95 @@
+#pragma once
+
+#include <QOpenGLExtraFunctions>
+
+#include <cstddef> // size_t
+
+class QOpenGLContext;
+class QOpenGLShaderProgram;
+class QOpenGLTexture;
+class QOpenGLVertexArrayObject;
+
+/*
+ *  Shadow copy of some OpenGL state of one context: current program,
+ *  texture bound to each unit, VAO, framebuffer, depth/blend settings.
+ *
+ *  Each setter only calls into the driver if the value differs from the
+ *  shadowed one, so consecutive draws sharing a material or geometry do
+ *  not rebind anything. This only works if all changes of the tracked
+ *  state go through the cache; after code that bypasses it (e.g. Qt
+ *  binding its own FBO in QOpenGLWidget), call invalidate().
+ *
+ *  The counters tell how many calls were issued and how many elided.
+ *
+ */
+class GLStateCache : protected QOpenGLExtraFunctions
+{
+public:
+
+    // cache of the current context, created on first use
+    static GLStateCache& current();
+
+    // forget all shadowed state, the next call of each setter is issued
+    void invalidate();
+
+    // program, textures, vertex array, framebuffer
+    void useProgram(QOpenGLShaderProgram& prog);
+    void bindTexture(int unit, GLenum target, GLuint texture);
+    void bindTexture(int unit, QOpenGLTexture& texture);
+    void bindVertexArray(GLuint vao);
+    void bindVertexArray(QOpenGLVertexArrayObject& vao);
+    void bindFramebuffer(GLuint fbo);
+
+    // fixed function state; enable() handles GL_DEPTH_TEST, GL_BLEND,
+    // GL_CULL_FACE and GL_SCISSOR_TEST
+    void enable(GLenum cap, bool on = true);
+    void disable(GLenum cap) { enable(cap, false); }
+    void depthFunc(GLenum func);
+    void blendFunc(GLenum src, GLenum dst);
+
+    // writes to the depth buffer / to all color channels on or off
+    void depthMask(bool on);
+    void colorMask(bool on);
+
+    // number of state changes passed on to OpenGL / skipped as redundant
+    struct Counters {
+        size_t issued = 0;
+        size_t elided = 0;
+    };
+    const Counters& counters() const { return counters_; }
+    void resetCounters() { counters_ = Counters(); }
+
+private:
+
+    explicit GLStateCache(QOpenGLContext* context);
+
+    // compare with the shadowed value, count, and remember the new one
+    bool changed_(GLuint& shadow, GLuint value) {
+        if(shadow == value) {
+            counters_.elided++;
+            return false;
+        }
+        shadow = value;
+        counters_.issued++;
+        return true;
+    }
+
+    // shadowed value after invalidate(), never equal to a real one
+    static const GLuint Unknown = ~0u;
+
+    enum { MaxTextureUnits = 32 };
+    enum Capability { DepthTest, Blend, CullFace, ScissorTest, NumCapabilities };
+
+    GLuint program_;
+    GLuint activeUnit_;
+    GLuint textureTarget_[MaxTextureUnits];
+    GLuint texture_[MaxTextureUnits];
+    GLuint vao_;
+    GLuint fbo_;
+    GLuint enabled_[NumCapabilities];
+    GLuint depthFunc_;
+    GLuint blendSrc_, blendDst_;
+    GLuint depthMask_, colorMask_;
+
+    Counters counters_;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <QString>
+
+#include <cstdint> // uint32_t
+#include <map>
+#include <memory>  // std::shared_ptr
+#include <utility> // std::move
+#include <vector>
+
+/*
+ *  Owner of scene objects (nodes, meshes, materials), addressed by
+ *  32 bit handles instead of names.
+ *
+ *  A handle is the index of the object's slot plus the slot's
+ *  generation. Removing an object frees the slot for reuse and bumps
+ *  its generation, so old handles to it resolve to nullptr instead of
+ *  to the next object in the slot.
+ *
+ *  Objects can be given a name when added; looking up names is meant
+ *  for setting up the scene and for UI events. Per frame, keep handles
+ *  and use get(), which is an index plus a compare.
+ *
+ *  The objects are still held by std::shared_ptr, since nodes share
+ *  their meshes and children and materials are shared by meshes.
+ *
+ */
+template<class T>
+class HandlePool
+{
+public:
+
+    class Handle
+    {
+    public:
+        Handle() {}
+        explicit operator bool() const { return value_ != 0; }
+        bool operator==(const Handle& other) const { return value_ == other.value_; }
+        bool operator!=(const Handle& other) const { return value_ != other.value_; }
+
+    private:
+        // 20 bits slot index, 12 bits generation (never 0, so 0 means no handle)
+        uint32_t value_ = 0;
+        Handle(uint32_t index, uint32_t generation) : value_(index << 12 | generation) {}
+        uint32_t index_() const { return value_ >> 12; }
+        uint32_t generation_() const { return value_ & 0xfff; }
+
+        friend class HandlePool;
+    };
+
+    // add an object, optionally under a name; if the name is already
+    // used, the old object is removed
+    Handle add(std::shared_ptr<T> object) { return add(QString(), std::move(object)); }
+    Handle add(const QString& name, std::shared_ptr<T> object);
+
+    // release the object and invalidate all handles to it
+    void remove(Handle handle);
+
+    // the object, or nullptr if the handle is empty or stale
+    T* get(Handle handle) const {
+        uint32_t i = handle.index_();
+        return i < slots_.size() && slots_[i].generation == handle.generation_()?
+                    slots_[i].object.get() : nullptr;
+    }
+    T* operator[](Handle handle) const { return get(handle); }
+
+    // the same as a shared pointer, for objects that keep a reference
+    const std::shared_ptr<T>& shared(Handle handle) const {
+        uint32_t i = handle.index_();
+        return i < slots_.size() && slots_[i].generation == handle.generation_()?
+                    slots_[i].object : none_;
+    }
+
+    // look up by name (not for per-frame use), empty handle / pointer if unknown
+    Handle find(const QString& name) const {
+        auto it = names_.find(name);
+        return it != names_.end()? it->second : Handle();
+    }
+    const std::shared_ptr<T>& operator[](const QString& name) const { return shared(find(name)); }
+
+    // call f(T&) for each object, in slot order
+    template<class F>
+    void forEach(F f) const {
+        for(const Slot& slot : slots_)
+            if(slot.object)
+                f(*slot.object);
+    }
+
+    // number of objects
+    size_t size() const { return slots_.size() - free_.size(); }
+
+private:
+
+    struct Slot {
+        std::shared_ptr<T> object;
+        uint32_t generation = 1;
+    };
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> free_;
+    std::map<QString, Handle> names_;
+    std::shared_ptr<T> none_;
+};
+
+template<class T>
+typename HandlePool<T>::Handle HandlePool<T>::add(const QString& name, std::shared_ptr<T> object)
+{
+    if(!name.isEmpty())
+        remove(find(name));
+
+    uint32_t index;
+    if(!free_.empty()) {
+        index = free_.back();
+        free_.pop_back();
+    } else {
+        index = uint32_t(slots_.size());
+        slots_.push_back(Slot());
+    }
+    slots_[index].object = std::move(object);
+
+    Handle handle(index, slots_[index].generation);
+    if(!name.isEmpty())
+        names_[name] = handle;
+    return handle;
+}
+
+template<class T>
+void HandlePool<T>::remove(Handle handle)
+{
+    if(!get(handle))
+        return;
+
+    uint32_t i = handle.index_();
+    slots_[i].object.reset();
+    slots_[i].generation = slots_[i].generation % 0xfff + 1; // 1..4095
+    free_.push_back(i);
+
+    for(auto it = names_.begin(); it != names_.end(); ++it) {
+        if(it->second == handle) {
+            names_.erase(it);
+            break;
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#include "instancebuffer.h"
+#include "mesh/geometrybuffers.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLVertexArrayObject>
+
+#include <assert.h>
+#include <algorithm> // std::max
+#include <map>
+
+using namespace std;
+
+bool InstanceBuffer::supported()
+{
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    assert(context);
+    return context->format().version() >= qMakePair(3, 3);
+}
+
+shared_ptr<InstanceBuffer> InstanceBuffer::current()
+{
+    static map<QOpenGLContext*, shared_ptr<InstanceBuffer>> buffers;
+
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    assert(context);
+
+    auto& buffer = buffers[context];
+    if(!buffer) {
+        buffer.reset(new InstanceBuffer(context));
+        QObject::connect(context, &QOpenGLContext::aboutToBeDestroyed,
+                         [context] { buffers.erase(context); });
+    }
+    return buffer;
+}
+
+InstanceBuffer::InstanceBuffer(QOpenGLContext* context)
+    : QOpenGLExtraFunctions(context)
+{
+    glGenBuffers(1, &buffer_);
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+    glDeleteBuffers(1, &buffer_);
+}
+
+void InstanceBuffer::attach(QOpenGLVertexArrayObject& vao)
+{
+    vao.bind();
+    glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+    const GLsizei stride = 16 * sizeof(float);
+    for(int column=0; column<4; column++) {
+        GLuint location = GeometryBuffers::InstanceMatrixAttribute + column;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, stride,
+                              reinterpret_cast<const void*>(column * 4 * sizeof(float)));
+        glVertexAttribDivisor(location, 1);
+    }
+    vao.release();
+}
+
+void InstanceBuffer::upload(const float* matrices, int count)
+{
+    GLsizeiptr size = GLsizeiptr(count) * 16 * sizeof(float);
+
+    // orphan the old storage; grow in steps, so this rarely changes the size
+    if(size > capacity_)
+        capacity_ = max(size, capacity_ * 2);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+    glBufferData(GL_ARRAY_BUFFER, capacity_, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, matrices);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <QOpenGLExtraFunctions>
+
+#include <memory> // std::shared_ptr
+
+class QOpenGLContext;
+class QOpenGLVertexArrayObject;
+
+/*
+ *  Per-instance model matrices for instanced drawing, one buffer per
+ *  OpenGL context.
+ *
+ *  Each mesh attaches the buffer to its VAO once (attribute locations
+ *  GeometryBuffers::InstanceMatrixAttribute .. +3, one per matrix column,
+ *  advancing once per instance). Before each instanced draw, the matrices
+ *  of that draw are uploaded to the start of the buffer; the old contents
+ *  are orphaned, so the driver does not have to wait for earlier draws.
+ *
+ *  Needs glVertexAttribDivisor, i.e. OpenGL 3.3; check supported() first.
+ *
+ */
+class InstanceBuffer : protected QOpenGLExtraFunctions
+{
+public:
+
+    // is instancing available in the current context?
+    static bool supported();
+
+    // buffer of the current context, created on first use
+    static std::shared_ptr<InstanceBuffer> current();
+
+    ~InstanceBuffer();
+
+    // set up the instance attributes in the VAO
+    void attach(QOpenGLVertexArrayObject& vao);
+
+    // column-major 4x4 matrices, 16 floats each
+    void upload(const float* matrices, int count);
+
+private:
+
+    explicit InstanceBuffer(QOpenGLContext* context);
+
+    GLuint buffer_ = 0;
+    GLsizeiptr capacity_ = 0;
+};
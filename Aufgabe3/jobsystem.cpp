@@ -0,0 +1,115 @@
+#include "jobsystem.h"
+
+#include <algorithm> // std::max
+#include <utility>   // std::move
+
+using namespace std;
+
+// queue of the current thread, 0 for threads that are not workers
+static thread_local int threadQueue = 0;
+
+JobSystem& JobSystem::instance()
+{
+    static JobSystem jobs(max(1, int(thread::hardware_concurrency()) - 1));
+    return jobs;
+}
+
+JobSystem::JobSystem(int numWorkers)
+{
+    for(int i=0; i<=numWorkers; i++)
+        queues_.push_back(make_unique<Queue>());
+    for(int i=1; i<=numWorkers; i++)
+        threads_.emplace_back(&JobSystem::worker_, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        lock_guard<mutex> lock(sleepMutex_);
+        quit_ = true;
+    }
+    wake_.notify_all();
+    for(auto& t : threads_)
+        t.join();
+}
+
+void JobSystem::run(Group& group, function<void()> job)
+{
+    group.pending_.fetch_add(1, memory_order_relaxed);
+    {
+        Queue& q = *queues_[threadQueue];
+        lock_guard<mutex> lock(q.mutex);
+        q.jobs.push_back(Job{ std::move(job), &group });
+    }
+    {
+        // counted under the lock, so a worker cannot miss it on its way to sleep
+        lock_guard<mutex> lock(sleepMutex_);
+        queued_++;
+    }
+    wake_.notify_one();
+}
+
+bool JobSystem::runOne_(int self)
+{
+    Job job;
+    bool found = false;
+
+    // own queue first, newest job
+    {
+        Queue& q = *queues_[self];
+        lock_guard<mutex> lock(q.mutex);
+        if(!q.jobs.empty()) {
+            job = std::move(q.jobs.back());
+            q.jobs.pop_back();
+            found = true;
+        }
+    }
+
+    // else steal the oldest job of another queue
+    const int n = int(queues_.size());
+    for(int k=1; k<n && !found; k++) {
+        Queue& q = *queues_[(self + k) % n];
+        lock_guard<mutex> lock(q.mutex);
+        if(!q.jobs.empty()) {
+            job = std::move(q.jobs.front());
+            q.jobs.pop_front();
+            found = true;
+        }
+    }
+
+    if(!found)
+        return false;
+    queued_--;
+    job.function();
+    job.group->pending_.fetch_sub(1, memory_order_release);
+    return true;
+}
+
+void JobSystem::wait(Group& group)
+{
+    while(group.busy()) {
+        if(!runOne_(threadQueue))
+            this_thread::yield();
+    }
+}
+
+void JobSystem::parallelFor(int count, const function<void(int)>& job)
+{
+    Group group;
+    for(int i=0; i<count; i++)
+        run(group, [&job, i]() { job(i); });
+    wait(group);
+}
+
+void JobSystem::worker_(int index)
+{
+    threadQueue = index;
+    for(;;) {
+        if(runOne_(index))
+            continue;
+        unique_lock<mutex> lock(sleepMutex_);
+        wake_.wait(lock, [this]() { return quit_ || queued_ > 0; });
+        if(quit_)
+            return;
+    }
+}
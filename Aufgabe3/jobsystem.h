@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>  // std::unique_ptr
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ *  Worker threads for the CPU side of a frame.
+ *
+ *  Each worker has its own queue of jobs: it takes new jobs from the
+ *  back of its queue (most recently added, still in the cache), and
+ *  when it runs dry, steals from the front of the other queues. Jobs
+ *  added from threads that are not workers (e.g. the GUI thread) go to
+ *  a shared queue that the workers steal from as well.
+ *
+ *  Jobs belong to a Group; wait() returns once all jobs of the group
+ *  are done, and meanwhile runs jobs itself instead of blocking.
+ *
+ *  Jobs must not touch OpenGL, there is no context on the workers.
+ *
+ */
+class JobSystem
+{
+public:
+
+    // the job system of the application, one worker per additional core
+    static JobSystem& instance();
+
+    ~JobSystem();
+
+    // jobs that can be waited for together
+    class Group
+    {
+    public:
+        Group() {}
+        Group(const Group&) = delete;
+        Group& operator=(const Group&) = delete;
+
+        // are jobs of this group still queued or running?
+        bool busy() const { return pending_.load(std::memory_order_acquire) > 0; }
+
+    private:
+        std::atomic<int> pending_{0};
+        friend class JobSystem;
+    };
+
+    // queue a job, returns immediately
+    void run(Group& group, std::function<void()> job);
+
+    // run jobs until all jobs of the group are done
+    void wait(Group& group);
+
+    // call job(i) for i in [0, count) in parallel, returns when all are done
+    void parallelFor(int count, const std::function<void(int)>& job);
+
+    // number of threads running jobs, including the one waiting
+    int numThreads() const { return int(threads_.size()) + 1; }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+private:
+
+    explicit JobSystem(int numWorkers);
+
+    struct Job {
+        std::function<void()> function;
+        Group* group;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    // queue 0 is shared by all threads that are not workers,
+    // queue i by worker i
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+
+    // sleeping workers wait for queued_ > 0
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    std::atomic<int> queued_{0};
+    bool quit_ = false;
+
+    // run one job from the own queue, or stolen from another one;
+    // false if there was none
+    bool runOne_(int self);
+
+    void worker_(int index);
+};
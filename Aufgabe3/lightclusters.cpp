@@ -0,0 +1,200 @@
+#include "lightclusters.h"
+#include "glstatecache.h"
+#include "jobsystem.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions_3_2_Core>
+
+#include <algorithm> // std::min, std::max, std::equal, std::copy
+#include <math.h>    // expf, logf
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CLUSTERS_SSE2
+#endif
+
+using namespace std;
+
+// buffer textures need OpenGL 3.1
+static QOpenGLFunctions_3_2_Core* functions()
+{
+    auto f = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_2_Core>();
+    if(!f || !f->initializeOpenGLFunctions())
+        qFatal("LightClusters: OpenGL 3.2 core functions not available");
+    return f;
+}
+
+static const int units[3] = { LightClusters::lightsUnit, LightClusters::rangesUnit,
+                              LightClusters::indicesUnit };
+
+LightClusters::LightClusters()
+    : ranges_(numClusters*2, 0), slices_(slices)
+{
+}
+
+LightClusters::~LightClusters()
+{
+    // the buffers go with the context, if it is gone already
+    if(buffers_[0] && QOpenGLContext::currentContext()) {
+        QOpenGLFunctions_3_2_Core* f = functions();
+        f->glDeleteTextures(3, textures_);
+        f->glDeleteBuffers(3, buffers_);
+    }
+}
+
+void LightClusters::assign(const QMatrix4x4& view, const QMatrix4x4& projection,
+                           const vector<Light>& lights)
+{
+    buildBoxes_(projection);
+
+    // lights for the shader, and in view space for the tests
+    lights_.resize(lights.size()*8);
+    viewLights_.clear();
+    for(size_t i=0; i<lights.size(); i++) {
+        const Light& light = lights[i];
+        float* l = &lights_[i*8];
+        l[0] = light.position_WC.x(); l[1] = light.position_WC.y(); l[2] = light.position_WC.z();
+        l[3] = light.radius;
+        l[4] = light.intensity.x(); l[5] = light.intensity.y(); l[6] = light.intensity.z();
+        l[7] = 0;
+        QVector3D p = view * light.position_WC;
+        viewLights_.add(p.x(), p.y(), -p.z(), light.radius, uint32_t(i));
+    }
+
+    // one job per slice
+    JobSystem::instance().parallelFor(slices, [this](int k) { assignSlice_(k); });
+
+    // concatenate the index lists of the slices
+    indices_.clear();
+    for(int k=0; k<slices; k++) {
+        uint32_t base = uint32_t(indices_.size());
+        uint32_t* range = &ranges_[k*tilesX*tilesY*2];
+        for(int c=0; c<tilesX*tilesY; c++)
+            range[2*c] += base;
+        indices_.insert(indices_.end(), slices_[k].indices.begin(), slices_[k].indices.end());
+    }
+}
+
+void LightClusters::assignSlice_(int k)
+{
+    Slice& slice = slices_[k];
+    slice.indices.clear();
+
+    // lights reaching into the depth range of the slice, shared by its clusters
+    const int first = k*tilesX*tilesY;
+    const float dmin = boxes_[first*6 + 2], dmax = boxes_[first*6 + 5];
+    Lights& lights = slice.lights;
+    lights.clear();
+    const Lights& all = viewLights_;
+    for(size_t i=0; i<all.x.size(); i++)
+        if(all.d[i] + all.r[i] >= dmin && all.d[i] - all.r[i] <= dmax)
+            lights.add(all.x[i], all.y[i], all.d[i], all.r[i], all.index[i]);
+    lights.pad();
+    const size_t n = lights.x.size();
+
+    for(int c=first; c<first + tilesX*tilesY; c++) {
+        const float* box = &boxes_[c*6];
+        uint32_t* range = &ranges_[c*2];
+        range[0] = uint32_t(slice.indices.size());
+
+        // distance from the light to the box, per axis, zero inside
+#ifdef CLUSTERS_SSE2
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 minX = _mm_set1_ps(box[0]), minY = _mm_set1_ps(box[1]), minD = _mm_set1_ps(box[2]);
+        const __m128 maxX = _mm_set1_ps(box[3]), maxY = _mm_set1_ps(box[4]), maxD = _mm_set1_ps(box[5]);
+        for(size_t i=0; i<n; i+=4) {
+            __m128 x = _mm_loadu_ps(&lights.x[i]);
+            __m128 y = _mm_loadu_ps(&lights.y[i]);
+            __m128 d = _mm_loadu_ps(&lights.d[i]);
+            __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minX, x), zero), _mm_max_ps(_mm_sub_ps(x, maxX), zero));
+            __m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minY, y), zero), _mm_max_ps(_mm_sub_ps(y, maxY), zero));
+            __m128 dd = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minD, d), zero), _mm_max_ps(_mm_sub_ps(d, maxD), zero));
+            __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dd, dd));
+            int hits = _mm_movemask_ps(_mm_cmple_ps(dist2, _mm_loadu_ps(&lights.r2[i])));
+            for(int j=0; hits; j++, hits >>= 1)
+                if(hits & 1)
+                    slice.indices.push_back(lights.index[i+j]);
+        }
+#else
+        for(size_t i=0; i<n; i++) {
+            float dx = max(box[0] - lights.x[i], 0.0f) + max(lights.x[i] - box[3], 0.0f);
+            float dy = max(box[1] - lights.y[i], 0.0f) + max(lights.y[i] - box[4], 0.0f);
+            float dd = max(box[2] - lights.d[i], 0.0f) + max(lights.d[i] - box[5], 0.0f);
+            if(dx*dx + dy*dy + dd*dd <= lights.r2[i])
+                slice.indices.push_back(lights.index[i]);
+        }
+#endif
+        range[1] = uint32_t(slice.indices.size()) - range[0];
+    }
+}
+
+void LightClusters::buildBoxes_(const QMatrix4x4& p)
+{
+    // only after the projection has changed
+    const float key[6] = { p(0,0), p(0,2), p(1,1), p(1,2), p(2,2), p(2,3) };
+    if(!boxes_.empty() && equal(key, key+6, projection_))
+        return;
+    copy(key, key+6, projection_);
+
+    // near and far plane from the OpenGL perspective matrix
+    near_ = key[5] / (key[4] - 1);
+    float farPlane = key[5] / (key[4] + 1);
+    sliceScale_ = slices / logf(farPlane / near_);
+
+    // a point at depth d with normalized device coordinate x is at d*(x + p02)/p00
+    boxes_.resize(numClusters*6);
+    for(int k=0; k<slices; k++) {
+        float d0 = near_ * expf(k / sliceScale_), d1 = near_ * expf((k+1) / sliceScale_);
+        for(int ty=0; ty<tilesY; ty++) {
+            float y0 = -1 + 2.0f*ty/tilesY, y1 = -1 + 2.0f*(ty+1)/tilesY;
+            for(int tx=0; tx<tilesX; tx++) {
+                float x0 = -1 + 2.0f*tx/tilesX, x1 = -1 + 2.0f*(tx+1)/tilesX;
+                float* box = &boxes_[((k*tilesY + ty)*tilesX + tx)*6];
+                float xs[4] = { d0*(x0 + key[1])/key[0], d0*(x1 + key[1])/key[0],
+                                d1*(x0 + key[1])/key[0], d1*(x1 + key[1])/key[0] };
+                float ys[4] = { d0*(y0 + key[3])/key[2], d0*(y1 + key[3])/key[2],
+                                d1*(y0 + key[3])/key[2], d1*(y1 + key[3])/key[2] };
+                box[0] = *min_element(xs, xs+4); box[3] = *max_element(xs, xs+4);
+                box[1] = *min_element(ys, ys+4); box[4] = *max_element(ys, ys+4);
+                box[2] = d0; box[5] = d1;
+            }
+        }
+    }
+}
+
+void LightClusters::upload()
+{
+    QOpenGLFunctions_3_2_Core* f = functions();
+    GLStateCache& gl = GLStateCache::current();
+
+    if(!buffers_[0]) {
+        static const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+        f->glGenBuffers(3, buffers_);
+        f->glGenTextures(3, textures_);
+        for(int i=0; i<3; i++) {
+            gl.bindTexture(units[i], GL_TEXTURE_BUFFER, textures_[i]);
+            f->glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers_[i]);
+        }
+    }
+
+    // new storage each frame, the draws of the last one may still read the old
+    const void* data[3] = { lights_.data(), ranges_.data(), indices_.data() };
+    GLsizeiptr sizes[3] = { GLsizeiptr(lights_.size()*sizeof(float)),
+                            GLsizeiptr(ranges_.size()*sizeof(uint32_t)),
+                            GLsizeiptr(indices_.size()*sizeof(uint32_t)) };
+    for(int i=0; i<3; i++) {
+        f->glBindBuffer(GL_TEXTURE_BUFFER, buffers_[i]);
+        if(sizes[i])
+            f->glBufferData(GL_TEXTURE_BUFFER, sizes[i], data[i], GL_STREAM_DRAW);
+        else
+            f->glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    }
+    f->glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::bind()
+{
+    GLStateCache& gl = GLStateCache::current();
+    for(int i=0; i<3; i++)
+        gl.bindTexture(units[i], GL_TEXTURE_BUFFER, textures_[i]);
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t
+#include <vector>
+
+/*
+ *  Point lights sorted into the clusters of the view frustum, for
+ *  clustered forward shading (CLUSTERED_LIGHTS in textured_phong.frag).
+ *
+ *  The frustum is divided into tilesX x tilesY tiles on screen and into
+ *  slices in depth, spaced exponentially from the near to the far plane.
+ *  Each frame, assign() tests the sphere of each light against the view
+ *  space bounding box of each cluster: one slice per job on the
+ *  JobSystem, four lights at a time with SSE. Each cluster then holds a
+ *  range in one list of light indices.
+ *
+ *  upload() copies the lights, the cluster ranges and the index list
+ *  into buffer textures, bind() binds them to fixed texture units.
+ *  Both need the OpenGL context, assign() does not.
+ *
+ *  The grid size must match the constants in textured_phong.frag.
+ *
+ */
+class LightClusters
+{
+public:
+
+    static const int tilesX = 16, tilesY = 8, slices = 24;
+    static const int numClusters = tilesX * tilesY * slices;
+
+    // texture units of the lights, the cluster ranges and the light indices
+    static const int lightsUnit = 7, rangesUnit = 8, indicesUnit = 9;
+
+    // point light, without any effect beyond its radius
+    struct Light {
+        QVector3D position_WC;
+        QVector3D intensity;
+        float radius;
+    };
+
+    LightClusters();
+    ~LightClusters();
+
+    // sort the lights into the clusters of the frustum of a perspective camera
+    void assign(const QMatrix4x4& view, const QMatrix4x4& projection,
+                const std::vector<Light>& lights);
+
+    // near plane and slices per unit of log(depth), for the shader (see FrameBlock)
+    float nearPlane() const { return near_; }
+    float sliceScale() const { return sliceScale_; }
+
+    // number of lights / entries in all clusters, after assign()
+    size_t numLights() const { return lights_.size() / 8; }
+    size_t numIndices() const { return indices_.size(); }
+
+    // copy the results into the buffer textures / bind these to their units
+    void upload();
+    void bind();
+
+private:
+
+    // per light: position_WC + radius, intensity + padding (two RGBA32F texels)
+    std::vector<float> lights_;
+
+    // per cluster: offset and count in indices_ (one RG32UI texel)
+    std::vector<uint32_t> ranges_;
+    std::vector<uint32_t> indices_;
+
+    // lights in view space (depth d = -z), as arrays for testing four at a
+    // time; the padding has a negative radius squared, so it hits nothing
+    struct Lights {
+        std::vector<float> x, y, d, r, r2;
+        std::vector<uint32_t> index;
+        void clear() { x.clear(); y.clear(); d.clear(); r.clear(); r2.clear(); index.clear(); }
+        void add(float px, float py, float pd, float radius, uint32_t i) {
+            x.push_back(px); y.push_back(py); d.push_back(pd);
+            r.push_back(radius); r2.push_back(radius*radius); index.push_back(i);
+        }
+        void pad() {
+            while(x.size() % 4) {
+                add(0, 0, 0, 0, 0);
+                r2.back() = -1;
+            }
+        }
+    };
+    Lights viewLights_;
+
+    // scratch of each slice job: lights reaching into the slice, and its
+    // index list with offsets relative to the slice
+    struct Slice {
+        Lights lights;
+        std::vector<uint32_t> indices;
+    };
+    std::vector<Slice> slices_;
+
+    // view space bounds of the clusters, for the projection of the last frame
+    std::vector<float> boxes_; // min x, y, d, max x, y, d per cluster
+    float projection_[6] = {0, 0, 0, 0, 0, 0};
+    float near_ = 0, sliceScale_ = 0;
+
+    void buildBoxes_(const QMatrix4x4& projection);
+    void assignSlice_(int slice);
+
+    // OpenGL buffers and their buffer textures: lights, ranges, indices
+    unsigned int buffers_[3] = {0, 0, 0};
+    unsigned int textures_[3] = {0, 0, 0};
+};
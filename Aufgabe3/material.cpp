@@ -3,95 +3,229 @@
 
 #include <QOpenGLFunctions>
 
+#include "frameblock.h"
+#include "glstatecache.h"
+#include "lightclusters.h"
+
+const int* Material::matrixLocations(size_t namesKey, const std::string* names)
+{
+    GLuint id = prog_->programId();
+    for(auto& entry : matrixLocations_)
+        if(entry.namesKey == namesKey && entry.programId == id)
+            return entry.location;
+
+    MatrixLocations entry;
+    entry.namesKey = namesKey;
+    entry.programId = id;
+    for(int i=0; i<6; i++)
+        entry.location[i] = prog_->uniformLocation(names[i].c_str());
+    matrixLocations_.push_back(entry);
+    return matrixLocations_.back().location;
+}
+
+const char* const SkyBoxMaterial::uniformNames_[] = {
+    "cubeMap", "skybox.intensity_scale"
+};
+
 void SkyBoxMaterial::apply(unsigned int)
 {
-    prog_->bind();
-    prog_->setUniformValue("cubeMap", tex_unit+0);
-    prog_->setUniformValue("skybox.intensity_scale", intensity_scale);
-    texture->bind(tex_unit+0);
+    GLStateCache& gl = GLStateCache::current();
+    gl.useProgram(*prog_);
+    uniforms_.resolve(*prog_);
+    prog_->setUniformValue(uniforms_[CubeMap], tex_unit+0);
+    prog_->setUniformValue(uniforms_[IntensityScale], intensity_scale);
+    gl.bindTexture(tex_unit+0, *texture);
 }
 
+const char* const PostMaterial::uniformNames_[] = {
+    "post_tex", "image_width", "image_height", "kernel_width", "kernel_height", "use_jitter"
+};
+
 void PostMaterial::apply(unsigned int)
 {
-    prog_->bind();
+    GLStateCache& gl = GLStateCache::current();
+    gl.useProgram(*prog_);
+    uniforms_.resolve(*prog_);
 
     // bind texture manually using its OpenGL ID
-    QOpenGLFunctions gl(QOpenGLContext::currentContext());
-    gl.glActiveTexture(GL_TEXTURE0 + tex_unit);
-    gl.glBindTexture(GL_TEXTURE_2D, post_texture_id);
-    prog_->setUniformValue("post_tex", tex_unit);
-    prog_->setUniformValue("image_width", (GLint)image_size.width());
-    prog_->setUniformValue("image_height", (GLint)image_size.height());
-    prog_->setUniformValue("kernel_width", (GLint)kernel_size.width());
-    prog_->setUniformValue("kernel_height", (GLint)kernel_size.height());
-    prog_->setUniformValue("use_jitter", use_jitter);
+    gl.bindTexture(tex_unit, GL_TEXTURE_2D, post_texture_id);
+    prog_->setUniformValue(uniforms_[PostTex], tex_unit);
+    prog_->setUniformValue(uniforms_[ImageWidth], (GLint)image_size.width());
+    prog_->setUniformValue(uniforms_[ImageHeight], (GLint)image_size.height());
+    prog_->setUniformValue(uniforms_[KernelWidth], (GLint)kernel_size.width());
+    prog_->setUniformValue(uniforms_[KernelHeight], (GLint)kernel_size.height());
+    prog_->setUniformValue(uniforms_[UseJitter], use_jitter);
 }
 
-void TexturedPhongMaterial::apply(unsigned int light_pass)
+const char* const DeferredLightingMaterial::uniformNames_[] = {
+    "gAlbedo", "gNormal", "gSpecular", "gEmission",
+    "clusterLights", "clusterRanges", "clusterIndices"
+};
+
+void DeferredLightingMaterial::apply(unsigned int)
 {
-    prog_->bind();
-
-    // globals
-    prog_->setUniformValue("time", time);
-    prog_->setUniformValue("ambientLightIntensity", ambientLightIntensity);
-
-    // point light
-    assert(light_pass>=0 && light_pass<lights.size());
-    prog_->setUniformValue("light.position_WC", lights[light_pass].position_WC);
-    prog_->setUniformValue("light.intensity", lights[light_pass].color * lights[light_pass].intensity);
-    prog_->setUniformValue("light.pass", light_pass);
-
-    // Phong
-    prog_->setUniformValue("phong.k_ambient",  phong.k_ambient);
-    prog_->setUniformValue("phong.k_diffuse",  phong.k_diffuse);
-    prog_->setUniformValue("phong.k_specular", phong.k_specular);
-    prog_->setUniformValue("phong.shininess",  phong.shininess);
-
-    // Env Map parameters
-    prog_->setUniformValue("envmap.useEnvironmentTexture", envmap.useEnvironmentTexture);
-    prog_->setUniformValue("envmap.k_mirror",   envmap.k_mirror);
-    prog_->setUniformValue("envmap.k_refract",  envmap.k_refract);
-    prog_->setUniformValue("envmap.refract_ratio",  envmap.refract_ratio);
-
-    // Planet textures
-    prog_->setUniformValue("tex.useDiffuseTexture", tex.useDiffuseTexture);
-    prog_->setUniformValue("tex.useEmissiveTexture", tex.useEmissiveTexture);
-    prog_->setUniformValue("tex.useGlossTexture", tex.useGlossTexture);
-    int unit = tex.tex_unit;
-    if(envmap.useEnvironmentTexture) {
-        prog_->setUniformValue("environmentTexture", unit);
-        environmentTexture->bind(unit++);
+    GLStateCache& gl = GLStateCache::current();
+    gl.useProgram(*prog_);
+    uniforms_.resolve(*prog_);
+
+    for(int i=0; i<4; i++) {
+        gl.bindTexture(tex_unit+i, GL_TEXTURE_2D, gbuffer[i]);
+        prog_->setUniformValue(uniforms_[Albedo+i], tex_unit+i);
     }
-    if(tex.useDiffuseTexture) {
-        prog_->setUniformValue("diffuseTexture", unit);
-        diffuseTexture->bind(unit++);
+
+    // lights per cluster, bound once per frame (see LightClusters::bind)
+    prog_->setUniformValue(uniforms_[ClusterLights], LightClusters::lightsUnit);
+    prog_->setUniformValue(uniforms_[ClusterRanges], LightClusters::rangesUnit);
+    prog_->setUniformValue(uniforms_[ClusterIndices], LightClusters::indicesUnit);
+}
+
+void DepthOnlyMaterial::apply(unsigned int)
+{
+    GLStateCache::current().useProgram(*prog_);
+}
+
+bool DepthOnlyMaterial::selectProgram(bool instanced)
+{
+    prog_ = permutations_->program(instanced? 1 : 0);
+    return true;
+}
+
+const char* const TexturedPhongMaterial::uniformNames_[] = {
+    "lightPass",
+    "environmentTexture", "diffuseTexture", "emissiveTexture", "glossTexture",
+    "bumpTexture", "displacementTexture", "textureArray",
+    "clusterLights", "clusterRanges", "clusterIndices"
+};
+
+static_assert(sizeof(GLint) == 4 && sizeof(float) == 4, "std140 block assumes 32 bit scalars");
+
+static void copy3(float* dest, const QVector3D& v)
+{
+    dest[0] = v.x(); dest[1] = v.y(); dest[2] = v.z();
+}
+
+unsigned int TexturedPhongMaterial::features() const
+{
+    unsigned int mask = 0;
+    if(envmap.useEnvironmentTexture) mask |= ENVIRONMENT_TEXTURE;
+    if(tex.useDiffuseTexture)        mask |= DIFFUSE_TEXTURE;
+    if(tex.useEmissiveTexture)       mask |= EMISSIVE_TEXTURE;
+    if(tex.useGlossTexture)          mask |= GLOSS_TEXTURE;
+    if(bump.use)                     mask |= BUMP_MAP;
+    if(displacement.use)             mask |= DISPLACEMENT_MAP;
+    if(textureArray)                 mask |= TEXTURE_ARRAY;
+    if(lighting == LoopLighting)      mask |= LIGHT_LOOP;
+    if(lighting == ClusteredLighting) mask |= CLUSTERED_LIGHTS;
+    if(lighting == DeferredLighting)  mask |= GBUFFER;
+    return mask;
+}
+
+bool TexturedPhongMaterial::selectProgram(bool instanced)
+{
+    if(!permutations_)
+        return !instanced;
+    unsigned int mask = features() | (instanced? INSTANCED : 0);
+    if(mask != programFeatures_) {
+        prog_ = permutations_->program(mask);
+        programFeatures_ = mask;
     }
-    if(tex.useEmissiveTexture) {
-        prog_->setUniformValue("emissiveTexture", unit);
-        emissiveTexture->bind(unit++);
+    return true;
+}
+
+GLuint TexturedPhongMaterial::textureKey() const
+{
+    if(textureArray)                 return textureArray->texture().textureId();
+    if(tex.useDiffuseTexture)        return diffuseTexture->textureId();
+    if(tex.useEmissiveTexture)       return emissiveTexture->textureId();
+    if(tex.useGlossTexture)          return glossTexture->textureId();
+    if(bump.use)                     return bump.tex->textureId();
+    if(displacement.use)             return displacement.tex->textureId();
+    if(envmap.useEnvironmentTexture) return environmentTexture->textureId();
+    return 0;
+}
+
+void TexturedPhongMaterial::apply(unsigned int light_pass)
+{
+    GLStateCache& gl = GLStateCache::current();
+    gl.useProgram(*prog_);
+    uniforms_.resolve(*prog_);
+
+    // material parameters: upload only after a change, then a single range bind
+    static_assert(sizeof(Block) == 192, "Block must match the std140 layout of MaterialBlock");
+    if(dirty_ || !block_.allocated()) {
+        Block b = {};
+        copy3(b.k_ambient, phong.k_ambient);
+        copy3(b.k_diffuse, phong.k_diffuse);
+        copy3(b.k_specular, phong.k_specular);
+        b.shininess = phong.shininess;
+        b.useEnvironmentTexture = envmap.useEnvironmentTexture;
+        copy3(b.k_mirror, envmap.k_mirror);
+        copy3(b.k_refract, envmap.k_refract);
+        b.refract_ratio = envmap.refract_ratio;
+        b.useDiffuseTexture = tex.useDiffuseTexture;
+        b.useEmissiveTexture = tex.useEmissiveTexture;
+        b.useGlossTexture = tex.useGlossTexture;
+        b.emissive_scale = tex.emissive_scale;
+        b.layers[0] = tex.diffuseLayer;
+        b.layers[1] = tex.emissiveLayer;
+        b.layers[2] = tex.glossLayer;
+        b.layers[3] = tex.bumpLayer;
+        b.bump_use = bump.use;
+        b.bump_debug = bump.debug != 0;
+        b.bump_scale = bump.scale;
+        b.displacement_use = displacement.use;
+        b.displacement_scale = displacement.scale;
+        copy3(b.ambientLightIntensity, ambientLightIntensity);
+        block_.upload(&b, sizeof(b));
+        dirty_ = false;
     }
-    if(tex.useGlossTexture) {
-        prog_->setUniformValue("glossTexture", unit);
-        glossTexture->bind(unit++);
+    block_.bind(materialBlockBinding);
+
+    // index into the lights of the FrameBlock
+    assert(light_pass < unsigned(FrameBlock::maxLights));
+    prog_->setUniformValue(uniforms_[LightPass], GLint(light_pass));
+
+    // lights per cluster, bound once per frame (see LightClusters::bind)
+    if(lighting == ClusteredLighting) {
+        prog_->setUniformValue(uniforms_[ClusterLights], LightClusters::lightsUnit);
+        prog_->setUniformValue(uniforms_[ClusterRanges], LightClusters::rangesUnit);
+        prog_->setUniformValue(uniforms_[ClusterIndices], LightClusters::indicesUnit);
     }
-    prog_->setUniformValue("tex.emissive_scale", tex.emissive_scale);
 
-    // bump & displacement mapping
-    prog_->setUniformValue("bump.use", bump.use);
-    if(bump.use) {
-        prog_->setUniformValue("bump.scale", bump.scale);
-        prog_->setUniformValue("bump.debug", bump.debug);
-        prog_->setUniformValue("bumpTexture", unit); bump.tex->bind(unit++);
+    // textures, on consecutive units
+    int unit = tex.tex_unit;
+    if(envmap.useEnvironmentTexture) {
+        prog_->setUniformValue(uniforms_[EnvironmentTexture], unit);
+        gl.bindTexture(unit++, *environmentTexture);
+    }
 
+    // with a texture array, materials sharing it (and the environment)
+    // end up with identical bindings, the state cache then skips them
+    if(textureArray) {
+        prog_->setUniformValue(uniforms_[ArrayTexture], unit);
+        textureArray->bind(unit++);
+    } else {
+        if(tex.useDiffuseTexture) {
+            prog_->setUniformValue(uniforms_[DiffuseTexture], unit);
+            gl.bindTexture(unit++, *diffuseTexture);
+        }
+        if(tex.useEmissiveTexture) {
+            prog_->setUniformValue(uniforms_[EmissiveTexture], unit);
+            gl.bindTexture(unit++, *emissiveTexture);
+        }
+        if(tex.useGlossTexture) {
+            prog_->setUniformValue(uniforms_[GlossTexture], unit);
+            gl.bindTexture(unit++, *glossTexture);
+        }
+        if(bump.use) {
+            prog_->setUniformValue(uniforms_[BumpTexture], unit); gl.bindTexture(unit++, *bump.tex);
+        }
     }
-    prog_->setUniformValue("displacement.use", displacement.use);
+
+    // displacement mapping
     if(displacement.use) {
-        prog_->setUniformValue("displacement.scale", displacement.scale);
-        prog_->setUniformValue("displacementTexture", unit); displacement.tex->bind(unit++);
+        prog_->setUniformValue(uniforms_[DisplacementTexture], unit); gl.bindTexture(unit++, *displacement.tex);
     }
 
 
 }
-
-
-
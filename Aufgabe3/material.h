@@ -4,7 +4,65 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
 
+#include "uniformbuffer.h"
+#include "shaderpermutations.h"
+#include "texturearray.h"
+
 #include <memory>
+#include <string>
+#include <vector>
+
+/*
+ *   Tables of uniform locations, one per shader program.
+ *
+ *   The names are given once (indexed by a slot enum of the material),
+ *   the locations are looked up by name only the first time a program
+ *   is used, and again after the tables were invalidated, e.g. after a
+ *   program has been relinked. So switching between programs, e.g. the
+ *   instanced and the plain permutation, costs no lookups.
+ *
+ */
+class UniformLocations
+{
+public:
+
+    // names must outlive the tables, usually a static array
+    UniformLocations(const char* const* names = nullptr, size_t count = 0)
+        : names_(names), count_(count)
+    {}
+
+    // switch to the table of this program, looked up if there is none yet
+    void resolve(QOpenGLShaderProgram& prog) {
+        GLuint id = prog.programId();
+        if(current_ < programIds_.size() && programIds_[current_] == id)
+            return;
+        for(current_=0; current_<programIds_.size(); current_++)
+            if(programIds_[current_] == id)
+                return;
+        programIds_.push_back(id);
+        for(size_t i=0; i<count_; i++)
+            locations_.push_back(prog.uniformLocation(names_[i]));
+    }
+
+    // location for a slot in the current table, -1 if not used by the program
+    int operator[](size_t slot) const {
+        return current_ < programIds_.size()? locations_[current_*count_ + slot] : -1;
+    }
+
+    // force new lookups with the next resolve()
+    void invalidate() {
+        programIds_.clear();
+        locations_.clear();
+        current_ = 0;
+    }
+
+private:
+    const char* const* names_;
+    size_t count_;
+    std::vector<GLuint> programIds_;  // one table per program
+    std::vector<int> locations_;      // count_ entries per table
+    size_t current_ = 0;
+};
 
 /*
  *   Interface for surface materials.
@@ -14,21 +72,68 @@ class Material
 {
 public:
 
-    // constructor requires an existing shader program
-    Material(std::shared_ptr<QOpenGLShaderProgram> prog)
-        :prog_(prog)
+    // constructor requires an existing shader program,
+    // plus the names of the uniforms the material sets (see UniformLocations)
+    Material(std::shared_ptr<QOpenGLShaderProgram> prog,
+             const char* const* uniformNames = nullptr, size_t numUniforms = 0)
+        :prog_(prog), uniforms_(uniformNames, numUniforms)
     {}
 
     // bind underlying shader program and set required uniforms
     virtual void apply(unsigned int light_pass = 0) = 0;
 
+    // choose the program for the current parameters (e.g. a shader permutation),
+    // called before any uniforms are set for a draw. With instanced, choose a
+    // program taking its model matrix from the instance attributes (see
+    // Mesh::drawInstanced); returns false if the material has none.
+    virtual bool selectProgram(bool instanced = false) { return !instanced; }
+
+    // render queue bucket for meshes with this material, see RenderQueue
+    enum Pass { OpaquePass = 0, SkyBoxPass, PostPass, NumPasses };
+    virtual Pass pass() const { return OpaquePass; }
+
+    // the material's main texture, used to group draws (0 = none)
+    virtual GLuint textureKey() const { return 0; }
+
+    // does the vertex shader move the vertices (e.g. displacement mapping)?
+    // then a plain transform of the positions does not give the same depth
+    virtual bool displacesVertices() const { return false; }
+
     // getter for the program object
     QOpenGLShaderProgram& program() const { return *prog_; }
 
+    // call after relinking the program, so uniform locations are looked up again
+    void invalidateUniformLocations() {
+        uniforms_.invalidate();
+        matrixLocations_.clear();
+    }
+
+    /*
+     *  Locations of the camera matrix uniforms (see Camera::setMatrices).
+     *  Cached per set of names, identified by namesKey, and per program.
+     */
+    const int* matrixLocations(size_t namesKey, const std::string* names);
+
+    // uniform buffer binding point used for per-material parameter blocks
+    // (binding 0 is the per-frame block, see FrameBlock)
+    static const GLuint materialBlockBinding = 1;
+
 protected:
 
     // reference to underlying shader program
     std::shared_ptr<QOpenGLShaderProgram> prog_;
+
+    // locations of the material's own uniforms, resolved in apply()
+    UniformLocations uniforms_;
+
+    // cached camera matrix locations, one entry per program and set of names
+    // (e.g. the plain and the instanced permutation)
+    struct MatrixLocations {
+        size_t namesKey;
+        GLuint programId;
+        int location[6];
+    };
+    std::vector<MatrixLocations> matrixLocations_;
 };
 
 
@@ -37,11 +142,15 @@ public:
 
     // constructor requires existing shader program
     PostMaterial(std::shared_ptr<QOpenGLShaderProgram> prog,
-                 int texunit = 0) : Material(prog), tex_unit(texunit) {}
+                 int texunit = 0) : Material(prog, uniformNames_, NumUniforms), tex_unit(texunit) {}
 
     // the texture to be post processed
     GLint post_texture_id;
 
+    // drawn in the post processing bucket
+    Pass pass() const override { return PostPass; }
+    GLuint textureKey() const override { return GLuint(post_texture_id); }
+
     // the image size ("resolution") of the texture, needs to be set from outside
     QSize image_size;
 
@@ -57,6 +166,11 @@ public:
     // bind underlying shader program and set required uniforms
     void apply(unsigned int light_pass = 0) override;
 
+private:
+
+    enum Uniform { PostTex, ImageWidth, ImageHeight, KernelWidth, KernelHeight, UseJitter,
+                   NumUniforms };
+    static const char* const uniformNames_[NumUniforms];
 };
 
 
@@ -65,7 +179,7 @@ public:
 
     // constructor requires existing shader program
     SkyBoxMaterial(std::shared_ptr<QOpenGLShaderProgram> prog,
-                    int texunit = 0) : Material(prog), tex_unit(texunit) {}
+                    int texunit = 0) : Material(prog, uniformNames_, NumUniforms), tex_unit(texunit) {}
 
     // the cube map
     std::shared_ptr<QOpenGLTexture> texture;
@@ -73,27 +187,117 @@ public:
     // intensity scaling factor
     float intensity_scale = 1.0;
 
+    // drawn after the opaque objects
+    Pass pass() const override { return SkyBoxPass; }
+    GLuint textureKey() const override { return texture? texture->textureId() : 0; }
+
     // texture unit to be used
     int tex_unit;
 
     // bind underlying shader program and set required uniforms
     void apply(unsigned int light_pass = 0) override;
 
+private:
+
+    enum Uniform { CubeMap, IntensityScale, NumUniforms };
+    static const char* const uniformNames_[NumUniforms];
 };
 
-class TexturedPhongMaterial : public Material {
+class DeferredLightingMaterial : public Material {
 public:
 
     // constructor requires existing shader program
+    DeferredLightingMaterial(std::shared_ptr<QOpenGLShaderProgram> prog,
+                             int texunit = 0) : Material(prog, uniformNames_, NumUniforms), tex_unit(texunit) {}
+
+    // textures of the G-buffer: albedo, normal, specular, emission (see GBuffer)
+    GLuint gbuffer[4] = {0, 0, 0, 0};
+
+    // drawn as a full screen rectangle, like the post processing
+    Pass pass() const override { return PostPass; }
+    GLuint textureKey() const override { return gbuffer[0]; }
+
+    // first of four texture units to be used
+    int tex_unit;
+
+    // bind underlying shader program and set required uniforms
+    void apply(unsigned int light_pass = 0) override;
+
+private:
+
+    enum Uniform { Albedo, Normal, Specular, Emission,
+                   ClusterLights, ClusterRanges, ClusterIndices, NumUniforms };
+    static const char* const uniformNames_[NumUniforms];
+};
+
+class DepthOnlyMaterial : public Material {
+public:
+
+    // constructor requires permutations of depth_only with the single
+    // feature INSTANCED
+    DepthOnlyMaterial(std::shared_ptr<ShaderPermutations> permutations)
+        : Material(permutations->program(0)), permutations_(permutations) {}
+
+    // no color, no textures: only the program
+    void apply(unsigned int light_pass = 0) override;
+
+    // both variants are available
+    bool selectProgram(bool instanced = false) override;
+
+private:
+    std::shared_ptr<ShaderPermutations> permutations_;
+};
+
+class TexturedPhongMaterial : public Material {
+public:
+
+    // constructor requires existing shader program, which is used as is:
+    // its #defines decide which features are compiled in, see Feature
     TexturedPhongMaterial(std::shared_ptr<QOpenGLShaderProgram> prog,
-                          int texunit = 0) : Material(prog)
+                          int texunit = 0) : Material(prog, uniformNames_, NumUniforms)
+    {
+        tex.tex_unit=texunit;
+    }
+
+    // constructor with permutations of textured_phong, the program is then
+    // chosen by the features in use, see features()
+    TexturedPhongMaterial(std::shared_ptr<ShaderPermutations> permutations,
+                          int texunit = 0)
+        : Material(permutations->program(0), uniformNames_, NumUniforms),
+          permutations_(permutations)
     {
         tex.tex_unit=texunit;
-        lights.push_back(PointLight()); // make sure there is at least one light
     }
 
-    // animation time
-    float time = 0.0;
+    // feature bits, each one turns on a #define of the same name in the shaders
+    enum Feature {
+        ENVIRONMENT_TEXTURE = 1 << 0,
+        DIFFUSE_TEXTURE     = 1 << 1,
+        EMISSIVE_TEXTURE    = 1 << 2,
+        GLOSS_TEXTURE       = 1 << 3,
+        BUMP_MAP            = 1 << 4,
+        DISPLACEMENT_MAP    = 1 << 5,
+        TEXTURE_ARRAY       = 1 << 6,
+        INSTANCED           = 1 << 7, // chosen per draw, see selectProgram()
+        LIGHT_LOOP          = 1 << 8,
+        CLUSTERED_LIGHTS    = 1 << 9,
+        GBUFFER             = 1 << 10
+    };
+    static std::vector<std::string> featureNames() {
+        return { "ENVIRONMENT_TEXTURE", "DIFFUSE_TEXTURE", "EMISSIVE_TEXTURE",
+                 "GLOSS_TEXTURE", "BUMP_MAP", "DISPLACEMENT_MAP", "TEXTURE_ARRAY",
+                 "INSTANCED", "LIGHT_LOOP", "CLUSTERED_LIGHTS", "GBUFFER" };
+    }
+
+    // feature mask for the current parameters
+    unsigned int features() const;
+
+    // how lights are shaded (other than per pass only with permutations):
+    // one draw per light pass, all lights of the FrameBlock in one draw,
+    // in one draw the lights of the fragment's cluster (see LightClusters),
+    // or later in screen space, the draw only fills the G-buffer (see GBuffer)
+    enum Lighting { PerPassLighting, LoopLighting, ClusteredLighting, DeferredLighting };
+    Lighting lighting = PerPassLighting;
 
     // ambient light
     QVector3D ambientLightIntensity = QVector3D(0.3f,0.3f,0.3f);
@@ -113,13 +317,6 @@ public:
         float refract_ratio = 1.5;
     } envmap;
 
-    struct PointLight {
-        QVector4D position_WC = QVector4D(0,1,5,1);
-        QVector3D color = QVector3D(1,1,1);
-        float intensity = 0.5;
-    };
-    std::vector<PointLight> lights;
-
     // planet-specific properties
     struct Textures {
         int tex_unit;     // first texture unit to be used
@@ -127,6 +324,8 @@ public:
         bool useEmissiveTexture = false;
         bool useGlossTexture = false;
         float emissive_scale = 1.0;
+        // layers in textureArray, if set
+        int diffuseLayer = 0, emissiveLayer = 0, glossLayer = 0, bumpLayer = 0;
     } tex;
 
     // textures cause trouble when inside structs :-(
@@ -135,6 +334,10 @@ public:
     std::shared_ptr<QOpenGLTexture> glossTexture;
     std::shared_ptr<QOpenGLTexture> environmentTexture;
 
+    // optional: if set, the diffuse, emissive, gloss and bump textures are
+    // layers of this array (see tex.*Layer) instead of separate textures
+    std::shared_ptr<TextureArray> textureArray;
+
     // bump mapping
     struct Bump {
         bool use = false;
@@ -150,9 +353,68 @@ public:
         std::shared_ptr<QOpenGLTexture> tex;
     } displacement;
 
-    // bind underlying shader program and set required uniforms
+    /*
+     *  The Phong, EnvMap, Textures, Bump and Displacement parameters and the
+     *  ambient light live in a uniform block, which is only uploaded again
+     *  after a change. Call this after changing any of them.
+     */
+    void markDirty() { dirty_ = true; }
+
+    // bind the program chosen by selectProgram() and set required uniforms.
+    // time, camera and lights come from the FrameBlock, light_pass selects the
+    // light (only with PerPassLighting)
     void apply(unsigned int light_pass = 0) override;
 
+    // switch to the permutation for features(), if constructed with permutations;
+    // only then an instanced variant is available
+    bool selectProgram(bool instanced = false) override;
+
+    // diffuse texture, or the next one in use; the environment is usually shared
+    GLuint textureKey() const override;
+
+    bool displacesVertices() const override { return displacement.use; }
+
+private:
+
+    enum Uniform {
+        LightPass,
+        EnvironmentTexture, DiffuseTexture, EmissiveTexture, GlossTexture,
+        BumpTexture, DisplacementTexture, ArrayTexture,
+        ClusterLights, ClusterRanges, ClusterIndices,
+        NumUniforms
+    };
+    static const char* const uniformNames_[NumUniforms];
+
+    // std140 layout of MaterialBlock in textured_phong.vert/.frag
+    struct Block {
+        // PhongMaterial phong
+        float k_ambient[3];  float pad0;
+        float k_diffuse[3];  float pad1;
+        float k_specular[3]; float shininess;
+        GLint debug_texcoords; float pad2[3];
+        // EnvMap envmap
+        GLint useEnvironmentTexture; float pad3[3];
+        float k_mirror[3];   float pad4;
+        float k_refract[3];  float refract_ratio;
+        // TexturedMaterial tex
+        GLint useDiffuseTexture, useEmissiveTexture, useGlossTexture;
+        float emissive_scale;
+        GLint layers[4];
+        // BumpMaterial bump
+        GLint bump_use, bump_debug; float bump_scale; float pad5;
+        // DisplacementMaterial displacement
+        GLint displacement_use; float displacement_scale; float pad6[2];
+        // ambientLightIntensity
+        float ambientLightIntensity[3]; float pad7;
+    };
+
+    // parameters in the shared uniform buffer, upload pending?
+    UniformBlockSlot block_;
+    bool dirty_ = true;
+
+    // specialized programs, and the feature mask of the current one
+    std::shared_ptr<ShaderPermutations> permutations_;
+    unsigned int programFeatures_ = 0;
 };
 
 
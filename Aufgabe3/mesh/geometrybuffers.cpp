@@ -15,6 +15,34 @@ GeometryBuffers::bbox() const
     return bbox_;
 }
 
+void
+GeometryBuffers::bindAttributeLocations(QOpenGLShaderProgram& prog)
+{
+    prog.bindAttributeLocation("position_MC",  PositionAttribute);
+    prog.bindAttributeLocation("normal_MC",    NormalAttribute);
+    prog.bindAttributeLocation("texcoord",     TexcoordAttribute);
+    prog.bindAttributeLocation("tangent_MC",   TangentAttribute);
+    prog.bindAttributeLocation("bitangent_MC", BitangentAttribute);
+    prog.bindAttributeLocation("instanceModelMatrix", InstanceMatrixAttribute);
+}
+
+void
+GeometryBuffers::bindPositions(QOpenGLVertexArrayObject& vao, QOpenGLShaderProgram& prog) const
+{
+    vao.bind();
+    prog.bind();
+
+    if(position_->numElements()) {
+        position_->bind();
+        prog.enableAttributeArray(PositionAttribute);
+        prog.setAttributeBuffer(PositionAttribute, GL_FLOAT, 0, 3);
+    }
+    if(index_->numElements())
+        index_->bind();
+
+    vao.release();
+}
+
 void
 GeometryBuffers::bind(QOpenGLVertexArrayObject& vao, QOpenGLShaderProgram& prog) const
 {
@@ -23,32 +51,32 @@ GeometryBuffers::bind(QOpenGLVertexArrayObject& vao, QOpenGLShaderProgram& prog)
 
     if(position_->numElements()) {
         position_->bind();
-        prog.enableAttributeArray("position_MC");
-        prog.setAttributeBuffer("position_MC", GL_FLOAT, 0, 3);
+        prog.enableAttributeArray(PositionAttribute);
+        prog.setAttributeBuffer(PositionAttribute, GL_FLOAT, 0, 3);
     }
 
     if(normal_->numElements()) {
         normal_->bind();
-        prog.enableAttributeArray("normal_MC");
-        prog.setAttributeBuffer("normal_MC", GL_FLOAT, 0, 3);
+        prog.enableAttributeArray(NormalAttribute);
+        prog.setAttributeBuffer(NormalAttribute, GL_FLOAT, 0, 3);
     }
 
     if(texcoord_ && texcoord_->numElements()) {
         texcoord_->bind();
-        prog.enableAttributeArray("texcoord");
-        prog.setAttributeBuffer("texcoord", GL_FLOAT, 0, 2);
+        prog.enableAttributeArray(TexcoordAttribute);
+        prog.setAttributeBuffer(TexcoordAttribute, GL_FLOAT, 0, 2);
     }
 
     if(tangent_ && tangent_->numElements()) {
         tangent_->bind();
-        prog.enableAttributeArray("tangent_MC");
-        prog.setAttributeBuffer("tangent_MC", GL_FLOAT, 0, 3);
+        prog.enableAttributeArray(TangentAttribute);
+        prog.setAttributeBuffer(TangentAttribute, GL_FLOAT, 0, 3);
     }
 
     if(bitangent_ && bitangent_->numElements()) {
         bitangent_->bind();
-        prog.enableAttributeArray("bitangent_MC");
-        prog.setAttributeBuffer("bitangent_MC", GL_FLOAT, 0, 3);
+        prog.enableAttributeArray(BitangentAttribute);
+        prog.setAttributeBuffer(BitangentAttribute, GL_FLOAT, 0, 3);
     }
 
     // do not forget: bind index buffer!
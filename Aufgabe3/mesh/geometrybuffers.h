@@ -28,6 +28,10 @@
  *
  *  The suffix _MC indicates model coordinates.
  *
+ *  Each attribute has a fixed location (see VertexAttribute), which every
+ *  program gets via bindAttributeLocations() before linking. So a VAO
+ *  stays valid for all programs, e.g. all permutations of a shader.
+ *
  *  GeometryBuffers does not store a program/material.
  *  The Mesh class combines GeometryBuffers with Material.
  *  One GeometryBuffers object can be shared among
@@ -39,11 +43,33 @@ class GeometryBuffers {
 
 public:
 
+    // fixed vertex attribute locations, the same in all programs
+    enum VertexAttribute {
+        PositionAttribute = 0,
+        NormalAttribute,
+        TexcoordAttribute,
+        TangentAttribute,
+        BitangentAttribute,
+        NumAttributes,
+
+        // per-instance model matrix, four locations (see InstanceBuffer)
+        InstanceMatrixAttribute = NumAttributes
+    };
+
+    // assign the fixed locations to the attribute names; call before linking
+    static void bindAttributeLocations(QOpenGLShaderProgram& prog);
+
     /*
      *  bind buffer objects to uniforms in a program. bindings are recorded in specified VAO.
      */
     virtual void bind(QOpenGLVertexArrayObject& vao, QOpenGLShaderProgram& prog) const;
 
+    /*
+     *  bind only the positions (and the index buffer) in the VAO, e.g. for
+     *  drawing depth only; fewer attributes to fetch per vertex
+     */
+    void bindPositions(QOpenGLVertexArrayObject& vao, QOpenGLShaderProgram& prog) const;
+
     /*
      *  ask for bounding box (without considering transformations)
      */
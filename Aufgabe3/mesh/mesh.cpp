@@ -1,6 +1,10 @@
 
 #include "mesh.h"
 #include "objloader.h"
+#include "glstatecache.h"
+#include "instancebuffer.h"
+
+#include <QOpenGLExtraFunctions>
 
 #include <iostream>
 #include <assert.h>
@@ -31,16 +35,63 @@ Mesh::Mesh(shared_ptr<GeometryBuffers> geometry,
     if (!vao_.create())
         qFatal("Mesh: unable to create VAO");
 
+    // binds VAO and program directly, not through the state cache
     geometry_->bind(vao_, material_->program());
+    if(InstanceBuffer::supported())
+        InstanceBuffer::current()->attach(vao_);
+    GLStateCache::current().invalidate();
 
 }
 
 void Mesh::draw(unsigned int light_pass)
 {
     material_->apply(light_pass);
-    vao_.bind();
+
+    // the VAO stays bound, so the next draw of the same geometry skips the bind
+    GLStateCache::current().bindVertexArray(vao_);
     glDrawElements(GL_TRIANGLES, GLsizei(geometry_->numIndices()), GL_UNSIGNED_INT, Q_NULLPTR);
-    vao_.release();
+}
+
+void Mesh::drawInstanced(const float* modelMatrices, int count, unsigned int light_pass)
+{
+    InstanceBuffer::current()->upload(modelMatrices, count);
+    material_->apply(light_pass);
+
+    GLStateCache::current().bindVertexArray(vao_);
+    QOpenGLContext::currentContext()->extraFunctions()->glDrawElementsInstanced(
+                GL_TRIANGLES, GLsizei(geometry_->numIndices()), GL_UNSIGNED_INT, Q_NULLPTR, count);
+}
+
+void Mesh::drawPositions(Material& material)
+{
+    material.apply();
+    bindPositionVao_(material);
+    glDrawElements(GL_TRIANGLES, GLsizei(geometry_->numIndices()), GL_UNSIGNED_INT, Q_NULLPTR);
+}
+
+void Mesh::drawPositionsInstanced(Material& material, const float* modelMatrices, int count)
+{
+    InstanceBuffer::current()->upload(modelMatrices, count);
+    material.apply();
+    bindPositionVao_(material);
+    QOpenGLContext::currentContext()->extraFunctions()->glDrawElementsInstanced(
+                GL_TRIANGLES, GLsizei(geometry_->numIndices()), GL_UNSIGNED_INT, Q_NULLPTR, count);
+}
+
+void Mesh::bindPositionVao_(Material& material)
+{
+    if(!positionVao_.isCreated()) {
+        if(!positionVao_.create())
+            qFatal("Mesh: unable to create VAO");
+
+        // binds VAO and program directly, not through the state cache
+        geometry_->bindPositions(positionVao_, material.program());
+        if(InstanceBuffer::supported())
+            InstanceBuffer::current()->attach(positionVao_);
+        GLStateCache::current().invalidate();
+        material.apply();
+    }
+    GLStateCache::current().bindVertexArray(positionVao_);
 }
 
 void Mesh::replaceMaterial(std::shared_ptr<Material> material)
@@ -54,6 +105,9 @@ void Mesh::replaceMaterial(std::shared_ptr<Material> material)
 
     material_ = material;
     geometry_->bind(vao_, material_->program());
+    if(InstanceBuffer::supported())
+        InstanceBuffer::current()->attach(vao_);
+    GLStateCache::current().invalidate();
 
 }
 
@@ -33,12 +33,24 @@ public:
     // Draw the mesh using the associated material
     void draw(unsigned int light_pass = 0);
 
+    // Draw count instances in one call, with model matrices as 16 floats each
+    // (column-major); the material must have selected its instanced program
+    void drawInstanced(const float* modelMatrices, int count, unsigned int light_pass = 0);
+
+    // Draw with another material that only needs the positions, e.g. for a
+    // depth pre-pass; uses a second VAO with just the position buffer
+    void drawPositions(Material& material);
+    void drawPositionsInstanced(Material& material, const float* modelMatrices, int count);
+
     // access geometry
     std::shared_ptr<GeometryBuffers> geometry() const { return geometry_; }
 
     // access material
     std::shared_ptr<Material> material() const { return material_; }
 
+    // OpenGL name of the VAO, e.g. to group draws of the same geometry
+    GLuint vertexArray() const { return vao_.objectId(); }
+
     // replace material, fill VAO with new bindings
     void replaceMaterial(std::shared_ptr<Material> material);
 
@@ -51,6 +63,10 @@ protected:
     // OpenGL vertex array object (VAO) representing the buffers' state
     QOpenGLVertexArrayObject vao_;
 
+    // VAO with the positions only, created on first use
+    QOpenGLVertexArrayObject positionVao_;
+    void bindPositionVao_(Material& material);
+
     // the actual geometry data
     std::shared_ptr<GeometryBuffers> geometry_;
 
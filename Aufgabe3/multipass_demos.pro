@@ -26,7 +26,24 @@ HEADERS      += \
     nodenavigator.h \
     cubemap.h \
     imagedisplaydialog.h \
-    imagedisplaybutton.h
+    imagedisplaybutton.h \
+    uniformbuffer.h \
+    frameblock.h \
+    glstatecache.h \
+    shaderpermutations.h \
+    renderqueue.h \
+    texturearray.h \
+    transformhierarchy.h \
+    frustum.h \
+    handlepool.h \
+    occlusionbuffer.h \
+    instancebuffer.h \
+    jobsystem.h \
+    commandqueue.h \
+    renderer.h \
+    lightclusters.h \
+    gbuffer.h \
+    depthprepass.h
 
 # C++ SOURCE FILES TO BE COMPILED AND LINKED TOGETHER
 SOURCES      += \
@@ -47,7 +64,20 @@ SOURCES      += \
     nodenavigator.cpp \
     cubemap.cpp \
     imagedisplaydialog.cpp \
-    imagedisplaybutton.cpp
+    imagedisplaybutton.cpp \
+    uniformbuffer.cpp \
+    glstatecache.cpp \
+    renderqueue.cpp \
+    texturearray.cpp \
+    transformhierarchy.cpp \
+    frustum.cpp \
+    occlusionbuffer.cpp \
+    instancebuffer.cpp \
+    jobsystem.cpp \
+    renderer.cpp \
+    lightclusters.cpp \
+    gbuffer.cpp \
+    depthprepass.cpp
 
 # RESOURCE FILES TO BE PROCESSED BY QT
 RESOURCES    += \
@@ -12,23 +12,19 @@ Node::Node(shared_ptr<Mesh> mesh,
 
 
 void
-Node::draw(const Camera &cam, unsigned int light_pass, QMatrix4x4 parent_transform) {
-
-    // chain this transformation with the parent's transformation
+Node::gather(const Camera &cam, RenderQueue &queue, QMatrix4x4 parent_transform) const
+{
     QMatrix4x4 transform = parent_transform * transformation;
 
-    // process children first
-    for(auto child : children)
-        child->draw(cam, light_pass, transform);
+    for(const auto& child : children)
+        child->gather(cam, queue, transform);
 
     if(mesh) {
-        // set uniforms for model matrix, modelview matrix, MVP matrix, normal matrix, etc.
-        cam.setMatrices(*mesh->material(), transform);
-
-        // issues actual draw call, draw mesh using current uniform values
-        mesh->draw(light_pass);
+        // depth of the bounding box center, the camera looks along -Z
+        QVector3D center = mesh->geometry()->bbox().center();
+        float depth = -(cam.viewMatrix() * transform * center).z();
+        queue.add(*mesh, transform, depth);
     }
-
 }
 
 void
@@ -45,12 +41,20 @@ Node::gatherChildrenTransformations(const Node& node,
         result.push_back(transform);
 
     // continue search for all children, adding this nodes's transform
-    for(auto child : children)
+    for(const auto& child : children)
         child->gatherChildrenTransformations(node,result,transform);
 }
 
-QMatrix4x4 Node::toWorldTransform(std::shared_ptr<Node> child) const
+QMatrix4x4 Node::toWorldTransform(const std::shared_ptr<Node>& child) const
 {
+    // both nodes in the same hierarchy, each only once: no search
+    TransformHierarchy* hierarchy = transformation.hierarchy();
+    int self = transformation.index(), other = child->transformation.index();
+    QMatrix4x4 matrix;
+    if(hierarchy && hierarchy == child->transformation.hierarchy() && self >= 0 && other >= 0 &&
+       hierarchy->relative(self, other, matrix))
+        return matrix;
+
     std::vector<QMatrix4x4> result;
 
     // gather transformation information recursively
@@ -61,3 +65,15 @@ QMatrix4x4 Node::toWorldTransform(std::shared_ptr<Node> child) const
 
     return result[0];
 }
+
+QMatrix4x4 Node::fromWorldTransform(const std::shared_ptr<Node>& child) const
+{
+    TransformHierarchy* hierarchy = transformation.hierarchy();
+    int self = transformation.index(), other = child->transformation.index();
+    QMatrix4x4 matrix;
+    if(hierarchy && hierarchy == child->transformation.hierarchy() && self >= 0 && other >= 0 &&
+       hierarchy->relativeInverse(self, other, matrix))
+        return matrix;
+
+    return toWorldTransform(child).inverted();
+}
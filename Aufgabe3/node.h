@@ -2,6 +2,8 @@
 
 #include "mesh/mesh.h"
 #include "camera.h"
+#include "renderqueue.h"
+#include "transformhierarchy.h"
 #include <QMatrix4x4>
 
 /*
@@ -9,8 +11,8 @@
  *
  *  Furthermore, it can have a vector of child nodes.
  *
- *  When drawing a node, child nodes will be drawn as well
- *  (in depth-first order), and transformations will be
+ *  When gathering the draws of a node, child nodes will be gathered
+ *  as well (in depth-first order), and transformations will be
  *  accumulated from parent to all children, in such
  *  way that the child transformation is multiplied
  *  from the right to the parent transformation.
@@ -27,26 +29,36 @@ public:
 
     // mesh and transformation
     std::shared_ptr<Mesh> mesh;
-    QMatrix4x4 transformation;
+    Transformation transformation;
+
+    // hides what is behind it in occlusion culling; only for meshes
+    // that fill their bounding box (cubes, walls), rebuild the
+    // TransformHierarchy after changing it
+    bool occluder = false;
 
     // list of child nodes
     std::vector<std::shared_ptr<Node>> children;
 
     /*
-     * draws the node by:
-     * - calculating and setting the model matrix and camera-dependent transformation matrices
-     * - drawing the mesh
+     * adds draws of this node and its children to a render queue,
+     * with accumulated transformations and distance to the camera
      */
-    void draw(const Camera& cam, unsigned int light_pass = 0,
-              QMatrix4x4 parent_transform = QMatrix4x4());
+    void gather(const Camera& cam, RenderQueue& queue,
+                QMatrix4x4 parent_transform = QMatrix4x4()) const;
 
     /*
      *  finds the node within the children of this node.
      *  and return list fo relative transformations
      *  from child coords to this node's parent's coords.
      *  Empty return vector means no child matches node.
+     *
+     *  If both nodes are in the same TransformHierarchy, its cached
+     *  world matrices are used instead of searching the children.
      */
-    QMatrix4x4 toWorldTransform(std::shared_ptr<Node> child) const;
+    QMatrix4x4 toWorldTransform(const std::shared_ptr<Node>& child) const;
+
+    // inverse of toWorldTransform(), also cached in a TransformHierarchy
+    QMatrix4x4 fromWorldTransform(const std::shared_ptr<Node>& child) const;
 
 
 protected:
@@ -37,7 +37,7 @@ void PositionNavigator::keyPressEvent(QKeyEvent *event)
 
     // translate from camera coords into model coords
     QMatrix4x4 camToWorld = world_->toWorldTransform(camera_);
-    QMatrix4x4 worldToModel = world_->toWorldTransform(node_).inverted();
+    QMatrix4x4 worldToModel = world_->fromWorldTransform(node_);
     QVector4D translation_mc = worldToModel * camToWorld * translation_ec;
     node_->transformation.translate(translation_mc.toVector3D());
 
@@ -52,7 +52,7 @@ void RotateZoom::keyPressEvent(QKeyEvent *event)
 {
     // translate Y axis from camera coords into model coords
     QMatrix4x4 camToWorld = world_->toWorldTransform(camera_);
-    QMatrix4x4 worldToModel = world_->toWorldTransform(node_).inverted();
+    QMatrix4x4 worldToModel = world_->fromWorldTransform(node_);
     QVector3D  y_axis_mc = (worldToModel * camToWorld * QVector4D(0,1,0,0) ).toVector3D();
 
 
@@ -111,8 +111,7 @@ void ModelTrackball::rotate(QVector2D xy)
 {
     // transformation from camera coords to model coords
     auto camToWorld = world_->toWorldTransform(camera_);
-    auto nodeToWorld = world_->toWorldTransform(node_);
-    auto camToNode = nodeToWorld.inverted()*camToWorld;
+    auto camToNode = world_->fromWorldTransform(node_)*camToWorld;
 
     // main axes converted to model space
     auto xAxis = camToNode*QVector4D(1,0,0,0);
@@ -128,8 +127,7 @@ void ModelTrackball::pan(QVector4D translation_ec)
 {
     // transformation from camera coords to model coords
     auto camToWorld = world_->toWorldTransform(camera_);
-    auto nodeToWorld = world_->toWorldTransform(node_);
-    auto camToNode = nodeToWorld.inverted()*camToWorld;
+    auto camToNode = world_->fromWorldTransform(node_)*camToWorld;
 
     QVector4D translation_mc = camToNode * translation_ec * pan_sensitivity;
     node_->transformation.translate(translation_mc.toVector3D());
@@ -0,0 +1,212 @@
+#include "occlusionbuffer.h"
+
+#include <algorithm> // std::min, std::max, std::swap, std::fill
+#include <limits>
+#include <math.h>    // floorf, ceilf, fabsf
+#include <utility>   // std::move
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_SSE2
+#endif
+
+using namespace std;
+
+// closer than this (in w) a vertex counts as crossing the near plane
+static const float nearW = 1e-3f;
+
+// the 12 triangles of a box, corner index bits 0/1/2: max x/y/z
+static const int boxTriangles[12][3] = {
+    {0,2,6}, {0,6,4},   // -x
+    {1,5,7}, {1,7,3},   // +x
+    {0,4,5}, {0,5,1},   // -y
+    {2,3,7}, {2,7,6},   // +y
+    {0,1,3}, {0,3,2},   // -z
+    {4,6,7}, {4,7,5}    // +z
+};
+
+OcclusionBuffer::OcclusionBuffer()
+    : depth_(width*height, numeric_limits<float>::infinity()),
+      tileMax_((width/tileSize)*(height/tileSize), numeric_limits<float>::infinity())
+{
+}
+
+OcclusionBuffer::~OcclusionBuffer()
+{
+    // the worker still uses our buffers
+    wait();
+}
+
+void OcclusionBuffer::start(const QMatrix4x4& viewProjection, vector<QVector3D> corners)
+{
+    // nothing has moved: the buffer (or the job still filling it) fits
+    if(started_ && viewProjection == viewProjection_ && corners == corners_)
+        return;
+
+    wait();
+    started_ = true;
+    viewProjection_ = viewProjection;
+    corners_ = std::move(corners);
+    JobSystem::instance().run(rasterized_, [this]() { rasterize_(); });
+}
+
+void OcclusionBuffer::wait()
+{
+    JobSystem::instance().wait(rasterized_);
+}
+
+void OcclusionBuffer::rasterize_()
+{
+    fill(depth_.begin(), depth_.end(), numeric_limits<float>::infinity());
+
+    for(size_t box=0; box+8 <= corners_.size(); box+=8) {
+
+        // corners in pixel coordinates, depth is w
+        float sx[8], sy[8], w[8];
+        for(int c=0; c<8; c++) {
+            QVector4D p = viewProjection_ * QVector4D(corners_[box+c], 1);
+            w[c] = p.w();
+            if(w[c] < nearW)
+                continue;
+            sx[c] = (0.5f * p.x()/w[c] + 0.5f) * width;
+            sy[c] = (0.5f * p.y()/w[c] + 0.5f) * height;
+        }
+
+        for(const auto& tri : boxTriangles) {
+            if(w[tri[0]] < nearW || w[tri[1]] < nearW || w[tri[2]] < nearW)
+                continue;
+            float x[3] = { sx[tri[0]], sx[tri[1]], sx[tri[2]] };
+            float y[3] = { sy[tri[0]], sy[tri[1]], sy[tri[2]] };
+            triangle_(x, y, max(w[tri[0]], max(w[tri[1]], w[tri[2]])));
+        }
+    }
+
+    // farthest depth of each tile
+    const int tilesX = width/tileSize, tilesY = height/tileSize;
+    for(int ty=0; ty<tilesY; ty++) {
+        for(int tx=0; tx<tilesX; tx++) {
+            float m = 0;
+            for(int y=ty*tileSize; y<(ty+1)*tileSize; y++) {
+                const float* row = &depth_[y*width + tx*tileSize];
+                for(int x=0; x<tileSize; x++)
+                    m = max(m, row[x]);
+            }
+            tileMax_[ty*tilesX + tx] = m;
+        }
+    }
+}
+
+void OcclusionBuffer::triangle_(const float* x, const float* y, float depth)
+{
+    // counter-clockwise in pixel coordinates, drop degenerate triangles
+    float area = (x[1]-x[0])*(y[2]-y[0]) - (y[1]-y[0])*(x[2]-x[0]);
+    if(fabsf(area) < 1e-6f)
+        return;
+    float px[3] = { x[0], x[1], x[2] }, py[3] = { y[0], y[1], y[2] };
+    if(area < 0) {
+        swap(px[1], px[2]);
+        swap(py[1], py[2]);
+    }
+
+    // pixels whose center may be inside, x aligned to groups of four
+    int x0 = max(0, int(floorf(min(px[0], min(px[1], px[2])))));
+    int x1 = min(width-1, int(ceilf(max(px[0], max(px[1], px[2])))));
+    int y0 = max(0, int(floorf(min(py[0], min(py[1], py[2])))));
+    int y1 = min(height-1, int(ceilf(max(py[0], max(py[1], py[2])))));
+    if(x0 > x1 || y0 > y1)
+        return;
+    x0 &= ~3;
+
+    // edge functions e = a*x + b*y + c, inside where all three are >= 0
+    float a[3], b[3], c[3];
+    for(int k=0; k<3; k++) {
+        int l = (k+1) % 3;
+        a[k] = -(py[l] - py[k]);
+        b[k] = px[l] - px[k];
+        c[k] = -(a[k]*px[k] + b[k]*py[k]);
+    }
+
+#ifdef OCCLUSION_SSE2
+    __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    __m128 d = _mm_set1_ps(depth);
+    __m128 zero = _mm_setzero_ps();
+    __m128 ea[3], estep[3];
+    for(int k=0; k<3; k++) {
+        ea[k] = _mm_set1_ps(a[k]);
+        estep[k] = _mm_set1_ps(4*a[k]);
+    }
+    for(int yi=y0; yi<=y1; yi++) {
+        float cy = yi + 0.5f;
+        __m128 e[3];
+        for(int k=0; k<3; k++)
+            e[k] = _mm_add_ps(_mm_set1_ps(b[k]*cy + c[k] + a[k]*x0), _mm_mul_ps(ea[k], offsets));
+        float* row = &depth_[yi*width];
+        for(int xi=x0; xi<=x1; xi+=4) {
+            // coverage mask of four pixels, keep the nearer depth where covered
+            __m128 inside = _mm_and_ps(_mm_cmpge_ps(e[0], zero),
+                            _mm_and_ps(_mm_cmpge_ps(e[1], zero), _mm_cmpge_ps(e[2], zero)));
+            if(_mm_movemask_ps(inside)) {
+                __m128 old = _mm_loadu_ps(row + xi);
+                __m128 nearer = _mm_min_ps(old, d);
+                _mm_storeu_ps(row + xi, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+            for(int k=0; k<3; k++)
+                e[k] = _mm_add_ps(e[k], estep[k]);
+        }
+    }
+#else
+    for(int yi=y0; yi<=y1; yi++) {
+        float cy = yi + 0.5f;
+        float* row = &depth_[yi*width];
+        for(int xi=x0; xi<=x1; xi++) {
+            float cx = xi + 0.5f;
+            if(a[0]*cx + b[0]*cy + c[0] >= 0 &&
+               a[1]*cx + b[1]*cy + c[1] >= 0 &&
+               a[2]*cx + b[2]*cy + c[2] >= 0)
+                row[xi] = min(row[xi], depth);
+        }
+    }
+#endif
+}
+
+bool OcclusionBuffer::isVisible(const float boxMin[3], const float boxMax[3]) const
+{
+    // screen rectangle and nearest depth of the box
+    float minX = numeric_limits<float>::infinity(), maxX = -minX;
+    float minY = minX, maxY = -minX, minW = minX;
+    for(int c=0; c<8; c++) {
+        QVector3D corner(c&1? boxMax[0] : boxMin[0], c&2? boxMax[1] : boxMin[1], c&4? boxMax[2] : boxMin[2]);
+        QVector4D p = viewProjection_ * QVector4D(corner, 1);
+        if(p.w() < nearW)
+            return true; // reaches the camera
+        float sx = (0.5f * p.x()/p.w() + 0.5f) * width;
+        float sy = (0.5f * p.y()/p.w() + 0.5f) * height;
+        minX = min(minX, sx); maxX = max(maxX, sx);
+        minY = min(minY, sy); maxY = max(maxY, sy);
+        minW = min(minW, p.w());
+    }
+    int x0 = max(0, int(floorf(minX))), x1 = min(width-1, int(ceilf(maxX)));
+    int y0 = max(0, int(floorf(minY))), y1 = min(height-1, int(ceilf(maxY)));
+    if(x0 > x1 || y0 > y1)
+        return true; // not on screen, leave this to the frustum test
+
+    // visible unless the occluders are strictly in front of the box at every
+    // pixel (so an occluder never hides itself); tiles whose farthest
+    // occluder is in front of the box are skipped at once
+    const int tilesX = width/tileSize;
+    for(int ty=y0/tileSize; ty<=y1/tileSize; ty++) {
+        for(int tx=x0/tileSize; tx<=x1/tileSize; tx++) {
+            if(tileMax_[ty*tilesX + tx] < minW)
+                continue;
+            int px0 = max(x0, tx*tileSize), px1 = min(x1, (tx+1)*tileSize-1);
+            int py0 = max(y0, ty*tileSize), py1 = min(y1, (ty+1)*tileSize-1);
+            for(int y=py0; y<=py1; y++) {
+                const float* row = &depth_[y*width];
+                for(int x=px0; x<=px1; x++)
+                    if(row[x] >= minW)
+                        return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include "jobsystem.h"
+
+#include <vector>
+
+/*
+ *  Low resolution depth buffer for occlusion culling on the CPU.
+ *
+ *  Occluders are boxes (8 corners in world coordinates), e.g. walls or
+ *  cubes that fill their bounding box. Their triangles are rasterized
+ *  with SSE, four pixels at a time, each with the depth of its farthest
+ *  vertex, so the buffer never claims more occlusion than there is.
+ *  Triangles crossing the near plane are skipped for the same reason.
+ *
+ *  Depth is the distance w in front of the camera. For each tile of
+ *  8x8 pixels the buffer also keeps the farthest depth, so most box
+ *  tests are decided per tile.
+ *
+ *  Rasterization runs as a job on the JobSystem: start() returns
+ *  immediately, wait() for it before calling isVisible(), which may
+ *  then be called from several threads at once.
+ *
+ *  The buffer is only valid for the camera it was drawn with, so it is
+ *  rasterized for the current frame, overlapping the frame's setup but
+ *  not the submission of the previous frame. With the same camera and
+ *  occluders as last time, start() keeps the buffer as it is.
+ *
+ */
+class OcclusionBuffer
+{
+public:
+
+    static const int width = 256, height = 128, tileSize = 8;
+
+    OcclusionBuffer();
+    ~OcclusionBuffer();
+
+    // rasterize the occluder boxes, 8 corners each (bit 0/1/2 of the index: max x/y/z),
+    // unless they and the camera are the same as for the last start()
+    void start(const QMatrix4x4& viewProjection, std::vector<QVector3D> corners);
+
+    // wait until the occluders are rasterized
+    void wait();
+
+    // can any part of the world space box be seen past the occluders?
+    bool isVisible(const float boxMin[3], const float boxMax[3]) const;
+
+private:
+
+    QMatrix4x4 viewProjection_;
+    std::vector<QVector3D> corners_;
+    JobSystem::Group rasterized_;
+    bool started_ = false;
+
+    // per pixel and per tile depth, +infinity where nothing was drawn
+    std::vector<float> depth_;
+    std::vector<float> tileMax_;
+
+    void rasterize_();
+    void triangle_(const float* x, const float* y, float depth);
+};
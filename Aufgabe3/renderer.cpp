@@ -0,0 +1,34 @@
+#include "renderer.h"
+#include "rtrglwidget.h"
+#include "scene.h"
+
+#include <QGuiApplication>
+#include <QMutexLocker>
+#include <QOpenGLContext>
+
+void Renderer::render()
+{
+    if(exiting_)
+        return;
+    QOpenGLContext* context = widget_->context();
+    if(!context || !widget_->isValid())
+        return;
+
+    // wait until the GUI thread has moved the context over to us
+    grabMutex_.lock();
+    emit contextWanted();
+    grabCondition_.wait(&grabMutex_);
+    QMutexLocker lock(&renderMutex_);
+    grabMutex_.unlock();
+    if(exiting_)
+        return;
+
+    // the widget's FBO is bound by makeCurrent()
+    widget_->makeCurrent();
+    widget_->scene().draw(widget_->defaultFramebufferObject());
+
+    // give the context back and let the GUI thread compose the frame
+    widget_->doneCurrent();
+    context->moveToThread(qGuiApp->thread());
+    QMetaObject::invokeMethod(widget_, "update");
+}
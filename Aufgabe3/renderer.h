@@ -0,0 +1,61 @@
+#pragma once
+
+#include <QObject>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <atomic>
+
+class rtrGLWidget;
+
+/*
+ *  Draws the scene of an rtrGLWidget on a thread of its own, so a busy
+ *  GUI thread (sliders, buffer displays) does not delay the frames.
+ *
+ *  Lives in a QThread owned by the widget. For each frame, render()
+ *  asks the GUI thread for the widget's context, draws into the
+ *  widget's FBO, hands the context back and schedules the composition.
+ *  While Qt composes or resizes the widget on the GUI thread, it holds
+ *  the renderer's lock.
+ *
+ *  (After Qt's "threaded QOpenGLWidget" example.)
+ *
+ */
+class Renderer : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    explicit Renderer(rtrGLWidget* widget) : widget_(widget) {}
+
+    // GUI thread: keep the render thread away from the context / FBO
+    void lock() { renderMutex_.lock(); }
+    void unlock() { renderMutex_.unlock(); }
+
+    // GUI thread: for handing over the context, see rtrGLWidget::grabContext()
+    QMutex* grabMutex() { return &grabMutex_; }
+    QWaitCondition* grabCondition() { return &grabCondition_; }
+
+    // GUI thread: stop rendering, before the thread is shut down
+    void prepareExit() { exiting_ = true; grabCondition_.wakeAll(); }
+
+signals:
+
+    // the render thread needs the context, which lives on the GUI thread
+    void contextWanted();
+
+public slots:
+
+    // draw one frame
+    void render();
+
+private:
+
+    rtrGLWidget* widget_;
+    std::atomic<bool> exiting_{false};
+
+    QMutex renderMutex_;
+    QMutex grabMutex_;
+    QWaitCondition grabCondition_;
+};
@@ -0,0 +1,175 @@
+#include "renderqueue.h"
+#include "camera.h"
+#include "mesh/mesh.h"
+#include "instancebuffer.h"
+
+#include <assert.h>
+#include <cstring> // std::memcpy
+
+using namespace std;
+
+// field widths of the sort key, see class comment
+static const int programBits = 10, materialBits = 12, textureBits = 10,
+                 vaoBits = 10, depthBits = 20;
+
+static uint64_t field(uint64_t value, int bits)
+{
+    return value & ((uint64_t(1) << bits) - 1);
+}
+
+// positive floats compare like their bit patterns, so the upper bits of
+// the pattern are an order-preserving quantization of the depth
+static uint64_t depthKey(float depth)
+{
+    if(!(depth > 0.0f))
+        return 0;
+    uint32_t bits;
+    memcpy(&bits, &depth, sizeof(bits));
+    return bits >> (31 - depthBits);
+}
+
+uint32_t RenderQueue::id_(IdMap& ids, uintptr_t object)
+{
+    auto it = ids.find(object);
+    if(it != ids.end())
+        return it->second;
+    uint32_t id = uint32_t(ids.size());
+    ids[object] = id;
+    return id;
+}
+
+void RenderQueue::clear()
+{
+    packets_.clear();
+    entries_.clear();
+}
+
+void RenderQueue::add(Mesh& mesh, const QMatrix4x4& modelMatrix, float viewDepth)
+{
+    Material& material = *mesh.material();
+
+    // the program the material will use for this draw
+    material.selectProgram();
+
+    uint64_t key = field(material.pass(), 2);
+    key = (key << programBits)  | field(id_(programIds_, material.program().programId()), programBits);
+    key = (key << materialBits) | field(id_(materialIds_, uintptr_t(&material)), materialBits);
+    key = (key << textureBits)  | field(id_(textureIds_, material.textureKey()), textureBits);
+    key = (key << vaoBits)      | field(id_(vaoIds_, mesh.vertexArray()), vaoBits);
+    key = (key << depthBits)    | depthKey(viewDepth);
+
+    entries_.push_back({ key, uint32_t(packets_.size()) });
+    packets_.push_back({ &mesh, modelMatrix });
+}
+
+void RenderQueue::sort()
+{
+    radixSort_();
+}
+
+void RenderQueue::radixSort_()
+{
+    const size_t n = entries_.size();
+    if(n < 2)
+        return;
+
+    // histograms of all eight digits in one sweep
+    size_t count[8][256] = {};
+    for(const Entry& e : entries_)
+        for(int d=0; d<8; d++)
+            count[d][(e.key >> (8*d)) & 0xff]++;
+
+    scratch_.resize(n);
+    for(int d=0; d<8; d++) {
+
+        // all keys share this digit: order stays as it is
+        if(count[d][(entries_[0].key >> (8*d)) & 0xff] == n)
+            continue;
+
+        size_t offset = 0;
+        for(int b=0; b<256; b++) {
+            size_t c = count[d][b];
+            count[d][b] = offset;
+            offset += c;
+        }
+        for(const Entry& e : entries_)
+            scratch_[count[d][(e.key >> (8*d)) & 0xff]++] = e;
+        entries_.swap(scratch_);
+    }
+}
+
+size_t RenderQueue::begin_(Material::Pass pass) const
+{
+    // entries of one pass are consecutive, the pass is in the topmost bits
+    size_t begin = 0, end = entries_.size();
+    while(begin < end && Material::Pass(entries_[begin].key >> 62) < pass)
+        begin++;
+    return begin;
+}
+
+size_t RenderQueue::runEnd_(size_t i, Material::Pass pass) const
+{
+    const size_t end = entries_.size();
+    if(i >= end || Material::Pass(entries_[i].key >> 62) != pass)
+        return i;
+    Mesh* mesh = packets_[entries_[i].index].mesh;
+    size_t j = i+1;
+    while(j < end && packets_[entries_[j].index].mesh == mesh)
+        j++;
+    return j;
+}
+
+const float* RenderQueue::instanceMatrices_(size_t i, size_t j)
+{
+    instanceData_.resize((j-i) * 16);
+    float* dest = instanceData_.data();
+    for(size_t k=i; k<j; k++, dest+=16)
+        memcpy(dest, packets_[entries_[k].index].modelMatrix.constData(), 16*sizeof(float));
+    return instanceData_.data();
+}
+
+void RenderQueue::submit(Material::Pass pass, const Camera& camera, unsigned int light_pass)
+{
+    bool instancing = InstanceBuffer::supported();
+    size_t i = begin_(pass), j;
+    while((j = runEnd_(i, pass)) != i) {
+
+        // run of packets with the same mesh
+        Mesh* mesh = packets_[entries_[i].index].mesh;
+        if(j-i > 1 && instancing && mesh->material()->selectProgram(true)) {
+            mesh->drawInstanced(instanceMatrices_(i, j), int(j-i), light_pass);
+        } else {
+            for(size_t k=i; k<j; k++) {
+                const Packet& packet = packets_[entries_[k].index];
+                camera.setMatrices(*mesh->material(), packet.modelMatrix);
+                mesh->draw(light_pass);
+            }
+        }
+        i = j;
+    }
+}
+
+bool RenderQueue::submitPositions(Material::Pass pass, const Camera& camera, Material& material)
+{
+    bool instancing = InstanceBuffer::supported();
+    bool complete = true;
+    size_t i = begin_(pass), j;
+    while((j = runEnd_(i, pass)) != i) {
+
+        // same choice as in submit(), so both compute the positions alike
+        Mesh* mesh = packets_[entries_[i].index].mesh;
+        if(mesh->material()->displacesVertices()) {
+            complete = false;
+        } else if(j-i > 1 && instancing && mesh->material()->selectProgram(true)) {
+            material.selectProgram(true);
+            mesh->drawPositionsInstanced(material, instanceMatrices_(i, j), int(j-i));
+        } else {
+            for(size_t k=i; k<j; k++) {
+                camera.setMatrices(material, packets_[entries_[k].index].modelMatrix);
+                mesh->drawPositions(material);
+            }
+        }
+        i = j;
+    }
+    return complete;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "material.h"
+
+#include <QMatrix4x4>
+
+#include <cstdint> // uint64_t
+#include <unordered_map>
+#include <vector>
+
+class Camera;
+class Mesh;
+
+/*
+ *  Draws collected during scene traversal, submitted in sorted order.
+ *
+ *  Each draw packet gets a 64 bit sort key, from most to least significant:
+ *
+ *     2 bits  pass (bucket: opaque, skybox, post, see Material::Pass)
+ *    10 bits  program
+ *    12 bits  material
+ *    10 bits  texture (Material::textureKey())
+ *    10 bits  VAO
+ *    20 bits  view depth, front to back
+ *
+ *  So all draws with the same program, material, texture and geometry
+ *  follow each other (and the GLStateCache skips the rebinds), while
+ *  within such a run opaque objects near the camera are drawn first
+ *  to get the most out of early depth rejection.
+ *
+ *  The ids in the key are small numbers handed out on first sight and
+ *  kept across frames; if a field overflows, its ids wrap around,
+ *  which only makes the order less ideal.
+ *
+ *  Consecutive packets of the same mesh are drawn with one instanced
+ *  draw call if the material has an instanced program.
+ *
+ */
+class RenderQueue
+{
+public:
+
+    // forget the packets of the last frame (ids are kept)
+    void clear();
+
+    // add a draw of the mesh with the given model matrix;
+    // viewDepth is the distance in front of the camera
+    void add(Mesh& mesh, const QMatrix4x4& modelMatrix, float viewDepth);
+
+    // sort all packets by their keys
+    void sort();
+
+    // draw all packets of one pass in sorted order
+    void submit(Material::Pass pass, const Camera& camera, unsigned int light_pass = 0);
+
+    // draw the positions of all packets of one pass with another material,
+    // e.g. depth only (see DepthPrePass), instanced where submit() would be;
+    // skips meshes whose material displaces its vertices and then returns false
+    bool submitPositions(Material::Pass pass, const Camera& camera, Material& material);
+
+    // number of packets in the queue
+    size_t size() const { return packets_.size(); }
+
+protected:
+
+    struct Packet {
+        Mesh* mesh;
+        QMatrix4x4 modelMatrix;
+    };
+    std::vector<Packet> packets_;
+
+    // sort key and packet index
+    struct Entry {
+        uint64_t key;
+        uint32_t index;
+    };
+    std::vector<Entry> entries_, scratch_;
+
+    // dense ids for programs, materials, textures and VAOs
+    typedef std::unordered_map<uintptr_t, uint32_t> IdMap;
+    IdMap programIds_, materialIds_, textureIds_, vaoIds_;
+    static uint32_t id_(IdMap& ids, uintptr_t object);
+
+    // 8 bit LSD radix sort of entries_, skipping digits that are all equal
+    void radixSort_();
+
+    // first entry of a pass, and the end of the run of the same mesh from entry i
+    size_t begin_(Material::Pass pass) const;
+    size_t runEnd_(size_t i, Material::Pass pass) const;
+
+    // gather the model matrices of entries i..j into instanceData_
+    const float* instanceMatrices_(size_t i, size_t j);
+
+    // model matrices of an instanced draw
+    std::vector<float> instanceData_;
+};
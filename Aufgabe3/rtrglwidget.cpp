@@ -1,10 +1,12 @@
 
 #include "rtrglwidget.h"
 #include "scene.h"
+#include "renderer.h"
 
 #include <QOpenGLShaderProgram>
 #include <QOpenGLTexture>
 #include <QMouseEvent>
+#include <QThread>
 
 #include <iostream>
 
@@ -13,10 +15,32 @@ using namespace std;
 rtrGLWidget::rtrGLWidget(QWidget *parent)
     : QOpenGLWidget(parent)
 {
+    thread_ = new QThread;
+    renderer_ = new Renderer(this);
+    renderer_->moveToThread(thread_);
+    connect(thread_, &QThread::finished, renderer_, &QObject::deleteLater);
+    connect(this, &rtrGLWidget::renderRequested, renderer_, &Renderer::render);
+    connect(renderer_, &Renderer::contextWanted, this, &rtrGLWidget::grabContext);
+
+    // while Qt uses the context / FBO on the GUI thread, the renderer must wait;
+    // after each composed frame, the next one is drawn
+    connect(this, &QOpenGLWidget::aboutToCompose, [this]() { renderer_->lock(); });
+    connect(this, &QOpenGLWidget::frameSwapped, [this]() {
+        renderer_->unlock();
+        emit renderRequested();
+    });
+    connect(this, &QOpenGLWidget::aboutToResize, [this]() { renderer_->lock(); });
+    connect(this, &QOpenGLWidget::resized, [this]() { renderer_->unlock(); });
+
+    thread_->start();
 }
 
 rtrGLWidget::~rtrGLWidget()
 {
+    renderer_->prepareExit();
+    thread_->quit();
+    thread_->wait();
+    delete thread_;
 }
 
 QSize rtrGLWidget::minimumSizeHint() const
@@ -61,9 +85,18 @@ void rtrGLWidget::initializeGL()
 
 }
 
-void rtrGLWidget::paintGL()
+void rtrGLWidget::paintEvent(QPaintEvent*)
 {
-    scene_->draw();
+    // drawn by the render thread
+}
+
+void rtrGLWidget::grabContext()
+{
+    renderer_->lock();
+    QMutexLocker lock(renderer_->grabMutex());
+    context()->moveToThread(thread_);
+    renderer_->grabCondition()->wakeAll();
+    renderer_->unlock();
 }
 
 void rtrGLWidget::resizeGL(int width, int height)
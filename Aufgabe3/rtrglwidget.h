@@ -4,6 +4,9 @@
  *  Initialized and holds the scene.
  *  Should be used to control mouse events.
  *
+ *  The scene is drawn on a render thread (see Renderer), not in
+ *  paintGL(); the widget only composes the finished frames.
+ *
  *  see also: http://doc.qt.io/qt-5/qopenglwidget.html
  */
 
@@ -18,6 +21,8 @@
 
 // forward declaration
 class Scene;
+class Renderer;
+class QThread;
 class QOpenGLShaderProgram;
 class QOpenGLTexture;
 
@@ -41,20 +46,32 @@ public:
 signals:
     void clicked();
 
+    // ask the render thread for the next frame
+    void renderRequested();
+
 protected:
     void initializeGL() override;
-    void paintGL() override;
     void resizeGL(int width, int height) override;
+    void paintEvent(QPaintEvent *event) override;
     void mousePressEvent(QMouseEvent *event) override;
     void mouseMoveEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
     void wheelEvent(QWheelEvent *event) override;
 
+private slots:
+
+    // hand the context over to the render thread
+    void grabContext();
+
 private:
 
     // scene to be drawn and/or manipulated
     std::shared_ptr<Scene> scene_;
 
+    // draws the scene, on its own thread
+    QThread* thread_;
+    Renderer* renderer_;
+
     QOpenGLDebugLogger *logger;
 };
 
@@ -3,13 +3,18 @@
 #include <iostream> // std::cout etc.
 #include <assert.h> // assert()
 #include <random>   // random number generation
+#include <algorithm> // std::min
 
 #include "geometries/cube.h" // geom::Cube
 #include "geometries/parametric.h" // geom::Sphere etc.
 #include "cubemap.h"
+#include "glstatecache.h"
 
 #include <QtMath>
 #include <QMessageBox>
+#include <QOpenGLExtraFunctions>
+#include <QFile>
+#include <QColor>
 
 using namespace std;
 
@@ -65,122 +70,186 @@ void Scene::makeNodes()
     auto bumps     = std::make_shared<QOpenGLTexture>(QImage(":/assets/textures/earth_topography_2048_NRM.png").mirrored());
     auto rtrsuper  = std::make_shared<QOpenGLTexture>(QImage(":/assets/textures/RTR-ist-super-4-3.png").mirrored());
 
-    auto wallTex      = std::make_shared<QOpenGLTexture>(QImage(":/assets/wall.jpg").mirrored());
+    QImage wallImage  = QImage(":/assets/wall.jpg").mirrored();
+    auto wallTex      = std::make_shared<QOpenGLTexture>(wallImage);
+
+    // material textures of the same size, as layers of one array texture
+    auto layers = std::make_shared<TextureArray>(wallImage.width(), wallImage.height());
+    int wallLayer = layers->add(wallImage);
 
     // load cube textures
     std::shared_ptr<QOpenGLTexture> cubetex = makeCubeMap(":/assets/textures/bridge2048");
 
-    // load shader source files and compile them into OpenGL program objects
-    auto phong_prog = createProgram(":/assets/shaders/textured_phong.vert", ":/assets/shaders/textured_phong.frag");
+    // variants of the textured Phong program, compiled on demand for the
+    // features a material uses
+    auto phong_variants = make_shared<ShaderPermutations>(
+                TexturedPhongMaterial::featureNames(),
+                [this](const string& defines) {
+                    return createProgram(":/assets/shaders/textured_phong.vert",
+                                         ":/assets/shaders/textured_phong.frag", "", defines);
+                });
 
     // make multiple instances of (non-) textured Phong material
-    materials_["red"] = std::make_shared<TexturedPhongMaterial>(phong_prog,1);
+    materials_.add("red", std::make_shared<TexturedPhongMaterial>(phong_variants,1));
     materials_["red"]->phong.k_diffuse = QVector3D(0.8f,0.1f,0.1f);
     materials_["red"]->phong.k_ambient = materials_["red"]->phong.k_diffuse * 0.3f;
     materials_["red"]->phong.shininess = 80;
     materials_["red"]->diffuseTexture = wallTex;
     materials_["red"]->tex.useDiffuseTexture = true;
+    materials_["red"]->textureArray = layers;
+    materials_["red"]->tex.diffuseLayer = wallLayer;
     materials_["red"]->envmap.useEnvironmentTexture = true;
     materials_["red"]->environmentTexture = cubetex;
-    materials_["red_original"] = std::make_shared<TexturedPhongMaterial>(*materials_["red"]);
+    materials_.add("red_original", std::make_shared<TexturedPhongMaterial>(*materials_["red"]));
     auto std = materials_["red"];
 
     // make multiple instances of (non-) textured Phong material
-    materials_["green"] = std::make_shared<TexturedPhongMaterial>(phong_prog,1);
+    materials_.add("green", std::make_shared<TexturedPhongMaterial>(phong_variants,1));
     materials_["green"]->phong.k_diffuse = QVector3D(0.1f,0.8f,0.1f);
     materials_["green"]->phong.k_ambient = materials_["green"]->phong.k_diffuse * 0.3f;
     materials_["green"]->phong.shininess = 80;
     materials_["green"]->envmap.useEnvironmentTexture = true;
     materials_["green"]->environmentTexture = cubetex;
-    materials_["green"] = std::make_shared<TexturedPhongMaterial>(*materials_["green"]);
+    materials_.add("green", std::make_shared<TexturedPhongMaterial>(*materials_["green"]));
     auto std1 = materials_["green"];
 
-    materials_["wall"] = std::make_shared<TexturedPhongMaterial>(phong_prog,1);
+    materials_.add("wall", std::make_shared<TexturedPhongMaterial>(phong_variants,1));
     materials_["wall"]->phong.k_diffuse = QVector3D(0.1f,0.8f,0.1f);
     materials_["wall"]->phong.k_ambient = materials_["wall"]->phong.k_diffuse * 0.3f;
     materials_["wall"]->phong.shininess = 80;
     materials_["wall"]->diffuseTexture = wallTex;
     materials_["wall"]->envmap.useEnvironmentTexture = true;
     materials_["wall"]->environmentTexture = cubetex;
-    materials_["wall"] = std::make_shared<TexturedPhongMaterial>(*materials_["wall"]);
+    materials_.add("wall", std::make_shared<TexturedPhongMaterial>(*materials_["wall"]));
     auto wall = materials_["wall"];
 
+    // all lights in one pass by default, see setLighting_()
+    materials_.forEach([this](TexturedPhongMaterial& mat) { mat.lighting = lighting_; });
+
     // post processing stuff, in separate tex units 10-12
     auto orig = createProgram(":/assets/shaders/post.vert",
                               ":/assets/shaders/original.frag");
-    post_materials_["original"] = make_shared<PostMaterial>(orig, 10);
+    post_materials_.add("original", make_shared<PostMaterial>(orig, 10));
 
     // depth of field program
     auto depth_of_field = createProgram(":assets/shaders/post.vert", ":/assets/shaders/depth_of_field.frag");
-    post_materials_["depth_of_field"] = make_shared<PostMaterial>(depth_of_field, 13);
+    post_materials_.add("depth_of_field", make_shared<PostMaterial>(depth_of_field, 13));
 
     auto blur = createProgram(":/assets/shaders/post.vert",
                               ":/assets/shaders/blur.frag");
-    post_materials_["blur"] = make_shared<PostMaterial>(blur, 11);
+    post_materials_.add("blur", make_shared<PostMaterial>(blur, 11));
 
     auto gaussA = createProgram(":/assets/shaders/post.vert",
                                 ":/assets/shaders/gauss_9x9_passA.frag");
     auto gaussB = createProgram(":/assets/shaders/post.vert",
                                 ":/assets/shaders/gauss_9x9_passB.frag");
-    post_materials_["gauss_1"] = make_shared<PostMaterial>(gaussA,11);
-    post_materials_["gauss_2"] = make_shared<PostMaterial>(gaussB,12);
+    post_materials_.add("gauss_1", make_shared<PostMaterial>(gaussA,11));
+    post_materials_.add("gauss_2", make_shared<PostMaterial>(gaussB,12));
+
+    // lighting pass of deferred shading, reads the G-buffer in tex units 10-13
+    auto deferred = createProgram(":/assets/shaders/deferred_lighting.vert",
+                                  ":/assets/shaders/deferred_lighting.frag");
+    deferredMaterial_ = make_shared<DeferredLightingMaterial>(deferred, 10);
+
+    // positions only, for the depth pre-pass
+    auto depth_variants = make_shared<ShaderPermutations>(
+                vector<string>{ "INSTANCED" },
+                [this](const string& defines) {
+                    return createProgram(":/assets/shaders/depth_only.vert",
+                                         ":/assets/shaders/depth_only.frag", "", defines);
+                });
+    prePass_.reset(new DepthPrePass(depth_variants));
 
     // load meshes from .obj files and assign shader programs to them
-    meshes_["Duck"]    = std::make_shared<Mesh>(":/assets/models/duck/duck.obj", std);
-    meshes_["Teapot"]  = std::make_shared<Mesh>(":/assets/models/teapot/teapot.obj", std);
+    meshes_.add("Duck",    std::make_shared<Mesh>(":/assets/models/duck/duck.obj", std));
+    meshes_.add("Teapot",  std::make_shared<Mesh>(":/assets/models/teapot/teapot.obj", std));
 
     // add meshes of some procedural geometry objects (not loaded from OBJ files)
-    meshes_["Cube"]         = std::make_shared<Mesh>(make_shared<geom::Cube>(), std);
-    meshes_["Cube1"]        = std::make_shared<Mesh>(make_shared<geom::Cube>(), std1);
-    meshes_["Cube2"]        = std::make_shared<Mesh>(make_shared<geom::Cube>(), std1);
-    meshes_["FloorRect"]    = std::make_shared<Mesh>(make_shared<geom::Rect>(500,500), wall);
-    meshes_["LeftRect"]     = std::make_shared<Mesh>(make_shared<geom::Rect>(500,500), wall);
-    meshes_["RightRect"]    = std::make_shared<Mesh>(make_shared<geom::Rect>(500,500), wall);
-    meshes_["Sphere"]       = std::make_shared<Mesh>(make_shared<geom::Sphere>(80,80), std);
-    meshes_["Torus"]        = std::make_shared<Mesh>(make_shared<geom::Torus>(4, 2, 80,20), std);
+    meshes_.add("Cube",         std::make_shared<Mesh>(make_shared<geom::Cube>(), std));
+    meshes_.add("Cube1",        std::make_shared<Mesh>(make_shared<geom::Cube>(), std1));
+    meshes_.add("Cube2",        std::make_shared<Mesh>(make_shared<geom::Cube>(), std1));
+    meshes_.add("FloorRect",    std::make_shared<Mesh>(make_shared<geom::Rect>(500,500), wall));
+    meshes_.add("LeftRect",     std::make_shared<Mesh>(make_shared<geom::Rect>(500,500), wall));
+    meshes_.add("RightRect",    std::make_shared<Mesh>(make_shared<geom::Rect>(500,500), wall));
+    meshes_.add("Sphere",       std::make_shared<Mesh>(make_shared<geom::Sphere>(80,80), std));
+    meshes_.add("Torus",        std::make_shared<Mesh>(make_shared<geom::Torus>(4, 2, 80,20), std));
 
     // full-screen rectangles for post processing
-    meshes_["original"]  = std::make_shared<Mesh>(make_shared<geom::RectXY>(1, 1),
-                                                  post_materials_["original"]);
-    nodes_["original"]   = createNode(meshes_["original"], false);
+    meshes_.add("original",  std::make_shared<Mesh>(make_shared<geom::RectXY>(1, 1),
+                                                  post_materials_["original"]));
+    nodes_.add("original",   createNode(meshes_["original"], false));
 
-    meshes_["blur"]      = std::make_shared<Mesh>(make_shared<geom::RectXY>(1, 1),
-                                                  post_materials_["blur"]);
-    nodes_["blur"]       = createNode(meshes_["blur"], false);
+    meshes_.add("blur",      std::make_shared<Mesh>(make_shared<geom::RectXY>(1, 1),
+                                                  post_materials_["blur"]));
+    nodes_.add("blur",       createNode(meshes_["blur"], false));
 
-    meshes_["depth_of_field"]   = std::make_shared<Mesh>(make_shared<geom::RectXY>(1, 1), post_materials_["depth_of_field"]);
-    nodes_["depth_of_field"]    = createNode(meshes_["depth_of_field"], false);
+    meshes_.add("depth_of_field",   std::make_shared<Mesh>(make_shared<geom::RectXY>(1, 1), post_materials_["depth_of_field"]));
+    nodes_.add("depth_of_field",    createNode(meshes_["depth_of_field"], false));
 
-    meshes_["gauss_1"]   = std::make_shared<Mesh>(make_shared<geom::RectXY>(1, 1), post_materials_["gauss_1"]);
-    nodes_["gauss_1"]    = createNode(meshes_["gauss_1"], false);
-    meshes_["gauss_2"]   = std::make_shared<Mesh>(make_shared<geom::RectXY>(1, 1), post_materials_["gauss_2"]);
-    nodes_["gauss_2"]    = createNode(meshes_["gauss_2"], false);
+    meshes_.add("gauss_1",   std::make_shared<Mesh>(make_shared<geom::RectXY>(1, 1), post_materials_["gauss_1"]));
+    nodes_.add("gauss_1",    createNode(meshes_["gauss_1"], false));
+    meshes_.add("gauss_2",   std::make_shared<Mesh>(make_shared<geom::RectXY>(1, 1), post_materials_["gauss_2"]));
+    nodes_.add("gauss_2",    createNode(meshes_["gauss_2"], false));
+
+    meshes_.add("deferred_lighting", std::make_shared<Mesh>(make_shared<geom::RectXY>(1, 1), deferredMaterial_));
+    nodes_.add("deferred_lighting",  createNode(meshes_["deferred_lighting"], false));
 
     // initial state of post processing phases
-    nodes_["post_pass_1"] = nodes_["depth_of_field"];
-    nodes_["post_pass_2"] = nullptr;
+    postPass_[0] = nodes_.find("depth_of_field");
+    postPass_[1] = NodeHandle();
 
     // pack each mesh into a scene node, along with a transform that scales
     // it to standard size [1,1,1]
-    nodes_["Cube"]    = createNode(meshes_["Cube"], true);
-    nodes_["Cube1"]    = createNode(meshes_["Cube1"], true);
-    nodes_["Cube2"]    = createNode(meshes_["Cube2"], true);
-
-    nodes_["Sphere"]  = createNode(meshes_["Sphere"], true);
-    nodes_["Torus"]   = createNode(meshes_["Torus"], true);
-    nodes_["Duck"]    = createNode(meshes_["Duck"], true);
-    nodes_["Teapot"]  = createNode(meshes_["Teapot"], true);
+    nodes_.add("Cube",    createNode(meshes_["Cube"], true));
+    nodes_.add("Cube1",    createNode(meshes_["Cube1"], true));
+    nodes_.add("Cube2",    createNode(meshes_["Cube2"], true));
+
+    nodes_.add("Sphere",  createNode(meshes_["Sphere"], true));
+    nodes_.add("Torus",   createNode(meshes_["Torus"], true));
+    nodes_.add("Duck",    createNode(meshes_["Duck"], true));
+    nodes_.add("Teapot",  createNode(meshes_["Teapot"], true));
+
+    // culling benchmark: 50k small cubes scattered over 100 grid cells
+    // around the origin; cells outside the view are rejected as a whole
+    nodes_.add("Cubes 50k", createNode(nullptr, false));
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> offset(-5.0f, 5.0f);
+    for(int cx=0; cx<10; cx++) {
+        for(int cz=0; cz<10; cz++) {
+            auto cell = createNode(nullptr, false);
+            cell->transformation.translate(QVector3D(10.0f*cx - 45.0f, 0, 10.0f*cz - 45.0f));
+            for(int i=0; i<500; i++) {
+                auto cube = createNode(meshes_["Cube"], true);
+                QMatrix4x4 pos;
+                pos.translate(QVector3D(offset(random), offset(random), offset(random)));
+                pos.scale(0.1f);
+                cube->transformation = pos * cube->transformation;
+                cell->children.push_back(cube);
+            }
+            nodes_["Cubes 50k"]->children.push_back(cell);
+        }
+    }
 
+    // walls between the rows of cells, hiding most of the cubes behind them
+    const char* walls[] = { "FloorRect", "LeftRect", "RightRect" };
+    for(int w=0; w<3; w++) {
+        auto wall = createNode(meshes_[walls[w]], false);
+        wall->transformation.translate(QVector3D(0, 0, 30.0f*w - 35.0f));
+        wall->transformation.rotate(90, QVector3D(1,0,0)); // stand upright, facing +Z
+        wall->transformation.scale(QVector3D(100, 1, 12));
+        wall->occluder = true;
+        nodes_["Cubes 50k"]->children.push_back(wall);
+    }
 }
 
-// once the nodes_ map is filled, construct a hierarchical scene from it
+// once the nodes_ pool is filled, construct a hierarchical scene from it
 void Scene::makeScene()
 {
     // world contains the scene plus the camera
-    nodes_["World"] = createNode(nullptr, false);
+    nodes_.add("World", createNode(nullptr, false));
 
     // scene means everything but the camera
-    nodes_["Scene"] = createNode(nullptr, false);
+    nodes_.add("Scene", createNode(nullptr, false));
     nodes_["World"]->children.push_back(nodes_["Scene"]);
 
     // initial model to be shown in the scene
@@ -189,38 +258,115 @@ void Scene::makeScene()
     nodes_["Scene"]->children.push_back(nodes_["Cube2"]);
 
     // add camera node
-    nodes_["Camera"] = createNode(nullptr, false);
+    nodes_.add("Camera", createNode(nullptr, false));
     nodes_["Camera"]->transformation.translate(QVector3D(0,0.5,3)); // move camera back and up a bit
     nodes_["Camera"]->transformation.rotate(-7.5, QVector3D(1,0,0)); // look down on scene
     nodes_["World"]->children.push_back(nodes_["Camera"]);
 
     // add a light relative to the world
-    nodes_["Light0"] = createNode(nullptr, false);
+    nodes_.add("Light0", createNode(nullptr, false));
     nodes_["World"]->children.push_back(nodes_["Light0"]);
-    lightNodes_.push_back(nodes_["Light0"]);
+    lightNodes_.push_back(nodes_.find("Light0"));
+    lights_.push_back(Light());
     nodes_["Light0"]->transformation.translate(QVector3D(-0.55f, 0.68f, 4.34f)); // above camera
 
+    // lighting benchmark: the three cubes among many small colored point
+    // lights, for clustered lighting; the other modes only use the first
+    // few lights (see FrameBlock::maxLights)
+    nodes_.add("Lights 256", createNode(nullptr, false));
+    nodes_["Lights 256"]->children.push_back(nodes_["Cube"]);
+    nodes_["Lights 256"]->children.push_back(nodes_["Cube1"]);
+    nodes_["Lights 256"]->children.push_back(nodes_["Cube2"]);
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for(int i=0; i<256; i++) {
+        QString name = QString("PointLight%1").arg(i);
+        nodes_.add(name, createNode(nullptr, false));
+        nodes_[name]->transformation.translate(QVector3D(6.0f*unit(random) - 3.0f,
+                                                         1.5f*unit(random) - 0.75f,
+                                                         7.0f*unit(random) - 6.0f));
+        nodes_["Lights 256"]->children.push_back(nodes_[name]);
+        lightNodes_.push_back(nodes_.find(name));
+        Light light;
+        QColor color = QColor::fromHsvF(unit(random), 0.8, 1.0);
+        light.color = QVector3D(color.redF(), color.greenF(), color.blueF());
+        light.intensity = 0.4f;
+        light.radius = 0.3f + 0.6f*unit(random);
+        lights_.push_back(light);
+    }
+
     // translate new cubes into the background
     nodes_["Cube1"]->transformation.translate(QVector3D(-1.0f, 0.0f, -5.0f));
     nodes_["Cube2"]->transformation.translate(QVector3D(1.0f, 0.0f, -2.0f));
+
+    hierarchy_.build(nodes_["World"]);
+
+    // nodes needed in every frame
+    worldNode_ = nodes_.find("World");
+    cameraNode_ = nodes_.find("Camera");
+    originalNode_ = nodes_.find("original");
+    deferredNode_ = nodes_.find("deferred_lighting");
 }
 
 
 // helper to load shaders and create programs
 shared_ptr<QOpenGLShaderProgram>
-Scene::createProgram(const string& vertex, const string& fragment, const string& geom)
+Scene::createProgram(const string& vertex, const string& fragment, const string& geom,
+                     const string& defines)
 {
     auto p = make_shared<QOpenGLShaderProgram>();
-    if(!p->addShaderFromSourceFile(QOpenGLShader::Vertex, vertex.c_str()))
+
+    // with Qt >= 5.9, sources are only compiled if Qt's program binary disk cache
+    // (keyed by the sources and the GL driver, in the user's cache directory) has
+    // no usable binary for them; a rejected binary falls back to compiling in link()
+    auto addShader = [&p, &defines](QOpenGLShader::ShaderType type, const string& file) {
+        if(defines.empty()) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+            return p->addCacheableShaderFromSourceFile(type, file.c_str());
+#else
+            return p->addShaderFromSourceFile(type, file.c_str());
+#endif
+        }
+
+        // #defines must follow the #version line
+        QFile f(file.c_str());
+        if(!f.open(QIODevice::ReadOnly))
+            return false;
+        QByteArray source = f.readAll();
+        int version = source.indexOf("#version");
+        int pos = version < 0? 0 : source.indexOf('\n', version) + 1;
+        source.insert(pos, defines.c_str());
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+        return p->addCacheableShaderFromSourceCode(type, source);
+#else
+        return p->addShaderFromSourceCode(type, source);
+#endif
+    };
+
+    if(!addShader(QOpenGLShader::Vertex, vertex))
         qFatal("could not add vertex shader");
-    if(!p->addShaderFromSourceFile(QOpenGLShader::Fragment, fragment.c_str()))
+    if(!addShader(QOpenGLShader::Fragment, fragment))
         qFatal("could not add fragment shader");
     if(!geom.empty()) {
-        if(!p->addShaderFromSourceFile(QOpenGLShader::Geometry, geom.c_str()))
+        if(!addShader(QOpenGLShader::Geometry, geom))
             qFatal("could not add geometryshader");
     }
+
+    // same attribute locations in all programs, so VAOs fit every program
+    GeometryBuffers::bindAttributeLocations(*p);
+    GBuffer::bindOutputLocations(*p);
+
     if(!p->link())
-        qFatal("could not link shader program");
+        qFatal("could not link shader program: %s", qPrintable(p->log()));
+
+    // uniform blocks go to fixed binding points, for all programs alike
+    QOpenGLExtraFunctions* gl = QOpenGLContext::currentContext()->extraFunctions();
+    GLuint frame = gl->glGetUniformBlockIndex(p->programId(), "FrameBlock");
+    if(frame != GL_INVALID_INDEX)
+        gl->glUniformBlockBinding(p->programId(), frame, FrameBlock::binding);
+    GLuint material = gl->glGetUniformBlockIndex(p->programId(), "MaterialBlock");
+    if(material != GL_INVALID_INDEX)
+        gl->glUniformBlockBinding(p->programId(), material, Material::materialBlockBinding);
 
     return p;
 }
@@ -252,109 +398,153 @@ void Scene::toggleAnimation(bool flag)
 
 void Scene::setSceneNode(QString node)
 {
-    auto n = nodes_[node];
-    assert(n);
-
-    nodes_["Scene"]->children.clear();
-    nodes_["Scene"]->children.push_back(n);
-
-    update();
+    post_([this, node]() {
+        auto n = nodes_[node];
+        assert(n);
+
+        nodes_["Scene"]->children.clear();
+        nodes_["Scene"]->children.push_back(n);
+        hierarchy_.build(nodes_["World"]);
+    });
 }
 
 // change background color
 void Scene::setBackgroundColor(QVector3D rgb) {
-    bgcolor_ = rgb; update();
+    post_([this, rgb]() { bgcolor_ = rgb; });
 }
 // methods to change common material parameters
+void Scene::useMultiPassLighting()
+{
+    setLighting_(TexturedPhongMaterial::PerPassLighting);
+}
+void Scene::useSinglePassLighting()
+{
+    setLighting_(TexturedPhongMaterial::LoopLighting);
+}
+void Scene::useClusteredLighting()
+{
+    setLighting_(TexturedPhongMaterial::ClusteredLighting);
+}
+void Scene::useDeferredLighting()
+{
+    setLighting_(TexturedPhongMaterial::DeferredLighting);
+}
+void Scene::setLighting_(TexturedPhongMaterial::Lighting lighting)
+{
+    post_([this, lighting]() {
+        lighting_ = lighting;
+        materials_.forEach([lighting](TexturedPhongMaterial& mat) { mat.lighting = lighting; });
+    });
+}
 void Scene::setLightIntensity(size_t i, float v)
 {
-    if(i>=lightNodes_.size())
-        return;
-    for(auto mat : materials_)
-        mat.second->lights[i].intensity = v; update();
+    post_([this, i, v]() {
+        if(i < lights_.size())
+            lights_[i].intensity = v;
+    });
 }
 void Scene::setAmbientScale(float v)
 {
-    materials_["red"]->phong.k_ambient = materials_["red_original"]->phong.k_ambient * v;
-    update();
+    post_([this, v]() {
+        materials_["red"]->phong.k_ambient = materials_["red_original"]->phong.k_ambient * v;
+        materials_["red"]->markDirty();
+    });
 }
 void Scene::setDiffuseScale(float v)
 {
-    materials_["red"]->phong.k_diffuse = materials_["red_original"]->phong.k_diffuse * v;
-    update();
+    post_([this, v]() {
+        materials_["red"]->phong.k_diffuse = materials_["red_original"]->phong.k_diffuse * v;
+        materials_["red"]->markDirty();
+    });
 }
 void Scene::setSpecularScale(float v)
 {
-    materials_["red"]->phong.k_specular = materials_["red_original"]->phong.k_specular * v;
-    update();
+    post_([this, v]() {
+        materials_["red"]->phong.k_specular = materials_["red_original"]->phong.k_specular * v;
+        materials_["red"]->markDirty();
+    });
 }
 void Scene::setShininess(float v)
 {
-    materials_["red"]->phong.shininess = v;
-    update();
+    post_([this, v]() {
+        materials_["red"]->phong.shininess = v;
+        materials_["red"]->markDirty();
+    });
 }
 
 // change kernel size of al post processing filters
 void Scene::setPostFilterKernelSize(int n) {
-    for(auto mat : post_materials_)
-        mat.second->kernel_size = QSize(n,n);
-    update();
+    post_([this, n]() {
+        post_materials_.forEach([n](PostMaterial& mat) { mat.kernel_size = QSize(n,n); });
+    });
 }
 
 // change post processing filter
 void Scene::useDepthOfField() {
-    nodes_["post_pass_1"] = nodes_["depth_of_field"];
-    nodes_["post_pass_2"] = nullptr;
-    update();
+    post_([this]() {
+        postPass_[0] = nodes_.find("depth_of_field");
+        postPass_[1] = NodeHandle();
+    });
 }
 void Scene::useTwoPassGauss() {
-    nodes_["post_pass_1"] = nodes_["gauss_1"];
-    nodes_["post_pass_2"] = nodes_["gauss_2"];
-    update();
+    post_([this]() {
+        postPass_[0] = nodes_.find("gauss_1");
+        postPass_[1] = nodes_.find("gauss_2");
+    });
 }
 void Scene::toggleJittering(bool value)
 {
-    for(auto m : post_materials_) m.second->use_jitter = value;
-    update();
+    post_([this, value]() {
+        post_materials_.forEach([value](PostMaterial& mat) { mat.use_jitter = value; });
+    });
 }
 void Scene::toggleSplitDisplay(bool value)
 {
-    split_display_ = value;
-    update();
+    post_([this, value]() { split_display_ = value; });
 }
 void Scene::toggleFBODisplay(bool value)
 {
-    show_FBOs_ = value;
-    update();
+    post_([this, value]() { show_FBOs_ = value; });
+}
+void Scene::toggleStatistics(bool value)
+{
+    post_([this, value]() { show_stats_ = value; });
 }
 
-// pass key/mouse events on to navigator objects
+// pass key/mouse events on to navigator objects; the events are
+// copied, the originals are gone when the render thread gets to them
 void Scene::keyPressEvent(QKeyEvent *event) {
 
     // if Alt is pressed, pass on to light navigator, else camera navigator
-    if(event->modifiers() & Qt::AltModifier) {
-        lightNavigator_->keyPressEvent(event);
-    } else {
-        cameraNavigator_->keyPressEvent(event);
-    }
-    update();
+    QKeyEvent e(*event);
+    post_([this, e]() mutable {
+        if(e.modifiers() & Qt::AltModifier) {
+            lightNavigator_->keyPressEvent(&e);
+        } else {
+            cameraNavigator_->keyPressEvent(&e);
+        }
+    });
 
 }
 // mouse press events all processed by trackball navigator
 void Scene::mousePressEvent(QMouseEvent *event)
 {
-    navigator_->mousePressEvent(event); update();
+    QMouseEvent e(*event);
+    post_([this, e]() mutable { navigator_->mousePressEvent(&e); });
 }
 void Scene::mouseMoveEvent(QMouseEvent *event)
 {
-    navigator_->mouseMoveEvent(event); update();
+    QMouseEvent e(*event);
+    post_([this, e]() mutable { navigator_->mouseMoveEvent(&e); });
 }
 void Scene::mouseReleaseEvent(QMouseEvent *event)
 {
-    navigator_->mouseReleaseEvent(event); update();
+    QMouseEvent e(*event);
+    post_([this, e]() mutable { navigator_->mouseReleaseEvent(&e); });
 }
 void Scene::wheelEvent(QWheelEvent *event) {
-    navigator_->wheelEvent(event); update();
+    QWheelEvent e(*event);
+    post_([this, e]() mutable { navigator_->wheelEvent(&e); });
 }
 
 // trigger a redraw of the widget through this method
@@ -363,16 +553,28 @@ void Scene::update()
     parent_->update();
 }
 
-void Scene::updateViewport(size_t width, size_t height)
+void Scene::post_(function<void()> command)
 {
-    glViewport(0,0,GLint(width),GLint(height));
+    commands_.push(std::move(command));
+    update();
+}
 
-    // discard existing FBOs; need to re-create with new size
-    fbo1_.reset();
-    fbo2_.reset();
+void Scene::updateViewport(size_t width, size_t height)
+{
+    qreal ratio = parent_->devicePixelRatio();
+    post_([this, width, height, ratio]() {
+        width_ = width;
+        height_ = height;
+        pixelRatio_ = ratio;
+
+        // discard existing FBOs; need to re-create with new size
+        fbo1_.reset();
+        fbo2_.reset();
+        gbuffer_.reset();
+    });
 }
 
-void Scene::draw()
+void Scene::draw(GLuint targetFramebuffer)
 {
     // calculate animation time
     chrono::milliseconds millisec_since_first_draw;
@@ -384,107 +586,237 @@ void Scene::draw()
     millisec_since_last_draw = chrono::duration_cast<chrono::milliseconds>(current - lastDrawTime_);
     lastDrawTime_ = current;
 
-    // set time uniform in animated shader(s)
     float t = millisec_since_first_draw.count() / 1000.0f;
-    for(auto mat : materials_)
-        mat.second->time = t;
+
+    // changes made by the GUI since the last frame
+    commands_.execute();
+
+    // Qt has bound the widget's framebuffer (and may have changed more state)
+    // since the last frame, so start with an empty state cache
+    GLStateCache& gl = GLStateCache::current();
+    gl.invalidate();
+    gl.resetCounters();
+    GLuint defaultFbo = targetFramebuffer;
+    glViewport(0, 0, GLint(width_*pixelRatio_), GLint(height_*pixelRatio_));
+
+    // set camera based on node in scene graph
+    Node& world = *nodes_[worldNode_];
+    QMatrix4x4 camToWorld = world.toWorldTransform(nodes_.shared(cameraNode_));
+    float aspect = float(width_)/float(height_);
+    LookAtCamera camera(camToWorld*QVector3D(0,0,0), // look from
+                        camToWorld*QVector3D(0,0,-1), // look along -Z
+                        camToWorld*QVector3D(0,1,0), // this way is up
+                        30.0f,   // field of view in up direction
+                        aspect, // aspect ratio
+                        0.01f,   // near plane
+                        10.0f    // far plane
+                        );
+    PostProcessingCamera postCamera;
+
+    // rasterize the occluders in the background until gathering the draws
+    occlusion_.start(camera.projectionMatrix() * camera.viewMatrix(), hierarchy_.occluderCorners());
+
+    // all lights in world coordinates; lights below a scene node
+    // (e.g. "Lights 256") only while it is shown
+    frameLights_.clear();
+    for(size_t i=0; i<lightNodes_.size(); i++) {
+        auto node = nodes_.shared(lightNodes_[i]);
+        if(node->transformation.hierarchy() != &hierarchy_)
+            continue;
+        LightClusters::Light light;
+        light.position_WC = world.toWorldTransform(node) * QVector3D(0,0,0);
+        light.intensity = lights_[i].color * lights_[i].intensity;
+        light.radius = lights_[i].radius;
+        frameLights_.push_back(light);
+    }
+
+    // camera, time and lights for all draws of this frame, uploaded once per view
+    FrameBlock frame = FrameBlock();
+    frame.time = t;
+    frame.setCamera(camera.viewMatrix(), camera.projectionMatrix());
+    for(const auto& light : frameLights_)
+        if(!frame.addLight(light.position_WC, light.intensity, light.radius))
+            break;
+
+    // sort the lights into the clusters of the view frustum
+    if(lighting_ == TexturedPhongMaterial::ClusteredLighting ||
+       lighting_ == TexturedPhongMaterial::DeferredLighting) {
+        clusters_.assign(camera.viewMatrix(), camera.projectionMatrix(), frameLights_);
+        clusters_.upload();
+        clusters_.bind();
+        frame.setClusters(width_*pixelRatio_, height_*pixelRatio_,
+                          clusters_.nearPlane(), clusters_.sliceScale());
+    }
+    frameBlocks_[SceneView].upload(&frame, sizeof(frame));
+    frame.setCamera(postCamera.viewMatrix(), postCamera.projectionMatrix());
+    frameBlocks_[PostView].upload(&frame, sizeof(frame));
 
     // create an FBO to render the scene into
     if(!fbo1_) {
 
         // for high-res Retina displays
-        auto pixel_scale = parent_->devicePixelRatio();
+        auto pixel_scale = pixelRatio_;
 
         // what kind of FBO do we want?
         auto fbo_format = QOpenGLFramebufferObjectFormat();
         fbo_format.setAttachment(QOpenGLFramebufferObject::Depth);
 
         // create some FBOs for post processing
-        fbo1_ = std::make_shared<QOpenGLFramebufferObject>(parent_->width()*pixel_scale,
-                                                          parent_->height()*pixel_scale,
+        fbo1_ = std::make_shared<QOpenGLFramebufferObject>(width_*pixel_scale,
+                                                          height_*pixel_scale,
                                                           fbo_format);
-        fbo2_ = std::make_shared<QOpenGLFramebufferObject>(parent_->width()*pixel_scale,
-                                                           parent_->height()*pixel_scale,
+        fbo2_ = std::make_shared<QOpenGLFramebufferObject>(width_*pixel_scale,
+                                                           height_*pixel_scale,
                                                            fbo_format);
         // qDebug() << "FBO size =" << fbo_->size();
     }
+    if(!gbuffer_ && lighting_ == TexturedPhongMaterial::DeferredLighting) {
+        gbuffer_ = std::make_shared<GBuffer>(fbo1_->size());
+        for(int i=0; i<GBuffer::NumAttachments; i++)
+            deferredMaterial_->gbuffer[i] = gbuffer_->texture(GBuffer::Attachment(i));
+    }
 
     // draw the actual scene into fbo1
-    fbo1_->bind();
-    draw_scene_();
-    fbo1_->release();
+    gl.bindFramebuffer(fbo1_->handle());
+    frameBlocks_[SceneView].bind(FrameBlock::binding);
+    draw_scene_(camera);
+    frameBlocks_[PostView].bind(FrameBlock::binding);
     auto fbo_to_be_rendered = fbo1_;
-    auto node_to_be_rendered = nodes_["post_pass_1"];
+    Node* node_to_be_rendered = nodes_[postPass_[0]];
 
     // second pass?
-    if(nodes_["post_pass_2"]) {
-        fbo2_->bind();
+    if(Node* pass2 = nodes_[postPass_[1]]) {
+        gl.bindFramebuffer(fbo2_->handle());
         post_draw_full_(*fbo_to_be_rendered, *node_to_be_rendered);
-        fbo2_->release();
         fbo_to_be_rendered = fbo2_;
-        node_to_be_rendered = nodes_["post_pass_2"];
+        node_to_be_rendered = pass2;
     }
 
     // final rendering pass, into visible framebuffer (object)
+    gl.bindFramebuffer(defaultFbo);
     if(split_display_) {
-        post_draw_split_(*fbo1_, *nodes_["original"],
+        post_draw_split_(*fbo1_, *nodes_[originalNode_],
                          *fbo_to_be_rendered, *node_to_be_rendered);
     } else {
         post_draw_full_(*fbo_to_be_rendered, *node_to_be_rendered);
     }
 
+    // no VAO left bound for Qt's own drawing (e.g. buffer binds would end up in it)
+    gl.bindVertexArray(0);
+
+    // if asked for: report state changes issued vs. elided by the cache,
+    // culling and lighting results, every 1000 frames
+    static size_t statecount=0;
+    if(show_stats_ && ++statecount % 1000 == 0) {
+        cout << "GL state changes per frame: " << gl.counters().issued << " issued, "
+             << gl.counters().elided << " elided" << endl;
+        cout << "meshes per frame: " << hierarchy_.cullStats().drawn << " drawn, "
+             << hierarchy_.cullStats().culled << " culled, "
+             << hierarchy_.cullStats().occluded << " occluded" << endl;
+        if(lighting_ == TexturedPhongMaterial::ClusteredLighting ||
+           lighting_ == TexturedPhongMaterial::DeferredLighting)
+            cout << "light clusters: " << clusters_.numLights() << " lights, "
+                 << clusters_.numIndices() << " entries" << endl;
+        cout << "overdraw: " << prePass_->overdraw() << ", depth pre-pass "
+             << (prePass_->active()? "on" : "off") << endl;
+    }
+
     // extract FBI image and display in the UI, every 20 frames
     static size_t framecount=20-2; // initially will render twice
     if(show_FBOs_) {
         if(++framecount % 20 == 0) {
             emit displayBufferContents(0, "rendered scene", fbo1_->toImage());
-            if(nodes_["post_pass_2"])
+            if(postPass_[1])
                 emit displayBufferContents(1, "post pass 1", fbo2_->toImage());
         }
     }
 }
 
-void Scene::draw_scene_()
+void Scene::draw_scene_(const Camera& camera)
 {
-
-    // set camera based on node in scene graph
-    QMatrix4x4 camToWorld = nodes_["World"]->toWorldTransform(nodes_["Camera"]);
-    float aspect = float(parent_->width())/float(parent_->height());
-    LookAtCamera camera(camToWorld*QVector3D(0,0,0), // look from
-                        camToWorld*QVector3D(0,0,-1), // look along -Z
-                        camToWorld*QVector3D(0,1,0), // this way is up
-                        30.0f,   // field of view in up direction
-                        aspect, // aspect ratio
-                        0.01f,   // near plane
-                        10.0f    // far plane
-                        );
-
-    // clear buffer
-    glClearColor(bgcolor_[0], bgcolor_[1], bgcolor_[2], 1.0);
+    // deferred: the surfaces go into the G-buffer first, where
+    // depth 0 marks the background (see GBuffer)
+    bool deferred = lighting_ == TexturedPhongMaterial::DeferredLighting;
+    if(deferred) {
+        gbuffer_->bind();
+        glClearColor(0, 0, 0, 0);
+    } else {
+        glClearColor(bgcolor_[0], bgcolor_[1], bgcolor_[2], 1.0);
+    }
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // first light pass: standard depth test, no blending
-    glDepthFunc(GL_LESS);
-    glEnable(GL_DEPTH_TEST);
-    glDisable(GL_BLEND);
-    glDisable(GL_CULL_FACE);
-
-    // draw one pass for each light
-    for(unsigned int i=0; i<lightNodes_.size(); i++) {
-
-        // determine current light position and set it in material
-        QMatrix4x4 lightToWorld = nodes_["World"]->toWorldTransform(lightNodes_[i]);
-        for(auto mat : materials_)
-            mat.second->lights[i].position_WC = lightToWorld * QVector3D(0,0,0);
-
-        // draw light pass i
-        nodes_["World"]->draw(camera, i);
-
-        // settings for i>0 (add light contributions using alpha blending)
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ONE,GL_ONE);
-        glDepthFunc(GL_EQUAL);
+    GLStateCache& gl = GLStateCache::current();
+    gl.depthFunc(GL_LESS);
+    gl.enable(GL_DEPTH_TEST);
+    gl.disable(GL_BLEND);
+    gl.disable(GL_CULL_FACE);
+
+    // collect and sort the draws once, then replay them for each light
+    hierarchy_.update();
+    queue_.clear();
+    hierarchy_.gather(camera, queue_, &occlusion_);
+    queue_.sort();
+
+    // depth pre-pass: then only the visible surfaces are shaded; meshes
+    // left out of it must still write their depth in the main pass
+    if(prePass_->begin()) {
+        bool complete = prePass_->draw(queue_, camera);
+        gl.depthFunc(complete? GL_EQUAL : GL_LEQUAL);
+        gl.depthMask(!complete);
     }
+
+    // opaque objects, with the first light pass in the reference mode;
+    // the samples shaded here tell whether the pre-pass pays off
+    prePass_->beginSamples();
+    queue_.submit(Material::OpaquePass, camera);
+    prePass_->endSamples();
+    gl.depthFunc(GL_LESS);
+    gl.depthMask(true);
+
+    // deferred: the lights are added in screen space
+    if(deferred) {
+        draw_deferred_lights_(camera);
+        return;
+    }
+
+    // sky box only once behind the opaque objects
+    queue_.submit(Material::SkyBoxPass, camera);
+
+    // single pass: the materials loop over all lights of the FrameBlock,
+    // or over the lights of the fragment's cluster, so each object is
+    // drawn exactly once
+    if(lighting_ != TexturedPhongMaterial::PerPassLighting)
+        return;
+
+    // reference: one pass for each light, light positions are in the FrameBlock;
+    // passes i>0 add the light contributions using alpha blending
+    gl.enable(GL_BLEND);
+    gl.blendFunc(GL_ONE,GL_ONE);
+    gl.depthFunc(GL_EQUAL);
+    size_t numLights = min(frameLights_.size(), size_t(FrameBlock::maxLights));
+    for(unsigned int i=1; i<numLights; i++)
+        queue_.submit(Material::OpaquePass, camera, i);
+}
+
+void Scene::draw_deferred_lights_(const Camera& camera)
+{
+    // the lit surfaces go into fbo1, where the post processing expects them;
+    // with the depth of the G-buffer for the sky box
+    GLStateCache& gl = GLStateCache::current();
+    gl.bindFramebuffer(fbo1_->handle());
+    glClearColor(bgcolor_[0], bgcolor_[1], bgcolor_[2], 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    gbuffer_->blitDepth(fbo1_->handle());
+
+    // one full screen rectangle, each pixel adds the lights of its cluster
+    gl.disable(GL_DEPTH_TEST);
+    PostProcessingCamera screen;
+    post_draw_node_(*nodes_[deferredNode_], screen);
+
+    // sky box behind the surfaces
+    gl.enable(GL_DEPTH_TEST);
+    queue_.submit(Material::SkyBoxPass, camera);
 }
 
 void Scene::post_draw_full_(QOpenGLFramebufferObject &fbo, Node& node)
@@ -497,18 +829,27 @@ void Scene::post_draw_full_(QOpenGLFramebufferObject &fbo, Node& node)
     int h = fbo.size().height();
 
     // use the texture from the FBO during rendering
-    for(auto mat : post_materials_) {
-        mat.second->post_texture_id = fbo.texture();
-        mat.second->image_size = QSize(w,h);
-    }
+    post_materials_.forEach([&](PostMaterial& mat) {
+        mat.post_texture_id = fbo.texture();
+        mat.image_size = QSize(w,h);
+    });
 
     // initial state for drawing full-viewport rectangles
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_BLEND);
+    GLStateCache& gl = GLStateCache::current();
+    gl.disable(GL_DEPTH_TEST);
+    gl.disable(GL_CULL_FACE);
+    gl.disable(GL_BLEND);
 
     // draw single full screen rectangle with post processing material
-    node.draw(camera);
+    post_draw_node_(node, camera);
+}
+
+void Scene::post_draw_node_(Node& node, const Camera& camera)
+{
+    postQueue_.clear();
+    node.gather(camera, postQueue_);
+    postQueue_.sort();
+    postQueue_.submit(Material::PostPass, camera);
 }
 
 void Scene::post_draw_split_(QOpenGLFramebufferObject &fbo1, Node& node1,
@@ -523,32 +864,33 @@ void Scene::post_draw_split_(QOpenGLFramebufferObject &fbo1, Node& node1,
     int halfw = w/2;
 
     // initial state for drawing full-viewport rectangles
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_BLEND);
+    GLStateCache& gl = GLStateCache::current();
+    gl.disable(GL_DEPTH_TEST);
+    gl.disable(GL_CULL_FACE);
+    gl.disable(GL_BLEND);
 
     // left half of node1
 
     // use texture from fbo1 during rendering
-    for(auto mat : post_materials_) {
-        mat.second->post_texture_id = fbo1.texture();
-        mat.second->image_size = QSize(w,h);
-    }
-    glEnable(GL_SCISSOR_TEST);
+    post_materials_.forEach([&](PostMaterial& mat) {
+        mat.post_texture_id = fbo1.texture();
+        mat.image_size = QSize(w,h);
+    });
+    gl.enable(GL_SCISSOR_TEST);
     glScissor(0,0,halfw,h);
-    node1.draw(camera);
+    post_draw_node_(node1, camera);
 
     // right half of node2
 
     // use texture from fbo2 during rendering
-    for(auto mat : post_materials_) {
-        mat.second->post_texture_id = fbo2.texture();
-        mat.second->image_size = QSize(w,h);
-    }
+    post_materials_.forEach([&](PostMaterial& mat) {
+        mat.post_texture_id = fbo2.texture();
+        mat.image_size = QSize(w,h);
+    });
 
     glScissor(halfw,0,w-halfw,h);
-    node2.draw(camera);
-    glDisable(GL_SCISSOR_TEST);
+    post_draw_node_(node2, camera);
+    gl.disable(GL_SCISSOR_TEST);
 }
 
 
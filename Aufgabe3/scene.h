@@ -12,6 +12,14 @@
 #include "camera.h"
 #include "node.h"
 #include "nodenavigator.h"
+#include "occlusionbuffer.h"
+#include "lightclusters.h"
+#include "gbuffer.h"
+#include "depthprepass.h"
+#include "handlepool.h"
+#include "commandqueue.h"
+#include "frameblock.h"
+#include "uniformbuffer.h"
 
 #include <memory> // std::unique_ptr
 #include <map>    // std::map
@@ -26,6 +34,10 @@
  *
  * Do not call render() directly, use update() instead.
  *
+ * draw() runs on the render thread (see Renderer). The slots are
+ * called on the GUI thread; they only post commands, which draw() runs
+ * before the next frame.
+ *
  */
 
 class Scene : public QObject, protected QOpenGLFunctions
@@ -35,7 +47,7 @@ class Scene : public QObject, protected QOpenGLFunctions
 public:
     explicit Scene(QWidget* parent, QOpenGLContext *context);
 
-    QMatrix4x4& worldTransform() { return nodes_["World"]->transformation; }
+    Transformation& worldTransform() { return nodes_[worldNode_]->transformation; }
 
 signals:
 
@@ -48,6 +60,10 @@ public slots:
 
     // methods to change common material parameters
     void toggleAnimation(bool flag);
+    void useMultiPassLighting();
+    void useSinglePassLighting();
+    void useClusteredLighting();
+    void useDeferredLighting();
     void setLightIntensity(size_t i, float v);
     void setAmbientScale(float v);
     void setDiffuseScale(float v);
@@ -61,6 +77,7 @@ public slots:
     void toggleJittering(bool value);
     void toggleSplitDisplay(bool value);
     void toggleFBODisplay(bool value);
+    void toggleStatistics(bool value);
 
     // change the node to be rendered in the scene
     void setSceneNode(QString node);
@@ -72,8 +89,9 @@ public slots:
     void mouseReleaseEvent(QMouseEvent *event);
     void wheelEvent(QWheelEvent *event);
 
-    // perform OpenGL rendering of the entire scene. Don't call this yourself.
-    void draw();
+    // perform OpenGL rendering of the entire scene into the given framebuffer
+    // (the widget's), on the render thread. Don't call this yourself.
+    void draw(GLuint targetFramebuffer);
 
     // trigger a redraw of the widget through this method
     void update();
@@ -84,22 +102,45 @@ public slots:
 protected:
 
     // draw the actual scene for one pass of a multi-pass algorithm
-    void draw_scene_();
+    void draw_scene_(const Camera& camera);
 
     // draw from FBO for post processing, use full viewport
     void post_draw_full_(QOpenGLFramebufferObject& fbo, Node& node);
     // draw from FBO, render left half of node1 + right half of node2
     void post_draw_split_(QOpenGLFramebufferObject &fbo1, Node &node1, QOpenGLFramebufferObject &fbo2, Node &node2);
+    // draw a full screen node of the post processing bucket
+    void post_draw_node_(Node& node, const Camera& camera);
+
+    // flattened scene graph below "World", rebuilt when the graph changes;
+    // also does the view-frustum culling
+    TransformHierarchy hierarchy_;
+
+    // occluders rasterized on the CPU while the frame is set up
+    OcclusionBuffer occlusion_;
+
+    // draws of the scene / of a post processing node, in sorted order
+    RenderQueue queue_;
+    RenderQueue postQueue_;
 
     // multi-pass rendering
     std::shared_ptr<QOpenGLFramebufferObject> fbo1_, fbo2_;
-    std::map<QString, std::shared_ptr<PostMaterial>> post_materials_;
+
+    HandlePool<PostMaterial> post_materials_;
     bool split_display_ = true;
     bool show_FBOs_ = false;
+    bool show_stats_ = false; // print the per-frame counters
 
     // parent widget
     QWidget* parent_;
 
+    // changes from the GUI thread, run by the render thread at the start of draw()
+    CommandQueue commands_;
+    void post_(std::function<void()> command);
+
+    // size of the drawing surface, set through updateViewport()
+    size_t width_ = 1, height_ = 1;
+    qreal pixelRatio_ = 1;
+
     // periodically update the scene for animations
     QTimer timer_;
 
@@ -112,30 +153,64 @@ protected:
     double angle = 0.0;
     bool rotationOn = true;
 
+    // one additive pass per light, all lights in one pass, clustered, or deferred
+    TexturedPhongMaterial::Lighting lighting_ = TexturedPhongMaterial::LoopLighting;
+    void setLighting_(TexturedPhongMaterial::Lighting lighting);
+
     // bg color
     QVector3D bgcolor_ = QVector3D(0.4f,0.4f,0.4f);
 
     // different materials to be demonstrated
-    std::map<QString, std::shared_ptr<TexturedPhongMaterial>> materials_;
+    HandlePool<TexturedPhongMaterial> materials_;
 
     // mesh(es) to be used / shared
-    std::map<QString, std::shared_ptr<Mesh>> meshes_;
-
-    // nodes to be used
-    std::map<QString, std::shared_ptr<Node>> nodes_;
-
-    // light nodes for any number of lights
-    std::vector<std::shared_ptr<Node>> lightNodes_;
+    HandlePool<Mesh> meshes_;
+
+    // nodes to be used, by name only when setting up or on UI events
+    HandlePool<Node> nodes_;
+    typedef HandlePool<Node>::Handle NodeHandle;
+
+    // nodes used in every frame; the post processing passes (second one optional)
+    NodeHandle worldNode_, cameraNode_, originalNode_;
+    NodeHandle postPass_[2];
+
+    // deferred shading: surface attributes, and the lighting pass reading them
+    std::shared_ptr<GBuffer> gbuffer_;
+    std::shared_ptr<DeferredLightingMaterial> deferredMaterial_;
+    NodeHandle deferredNode_;
+    void draw_deferred_lights_(const Camera& camera);
+
+    // depth-only pass before the opaque objects, if the overdraw is high enough
+    std::unique_ptr<DepthPrePass> prePass_;
+
+    // light nodes for any number of lights, plus their color and intensity
+    std::vector<NodeHandle> lightNodes_;
+    struct Light {
+        QVector3D color = QVector3D(1,1,1);
+        float intensity = 0.5;
+        float radius = 100; // no effect beyond
+    };
+    std::vector<Light> lights_;
+
+    // all lights of the frame in world coordinates, sorted into clusters
+    std::vector<LightClusters::Light> frameLights_;
+    LightClusters clusters_;
+
+    // per-frame uniforms (camera, time, lights) for the scene and the post processing view
+    enum FrameView { SceneView, PostView, NumFrameViews };
+    UniformBlockSlot frameBlocks_[NumFrameViews];
 
     // navigation
     std::unique_ptr<ModelTrackball> navigator_;
     std::unique_ptr<PositionNavigator> lightNavigator_;
     std::unique_ptr<RotateCameraY> cameraNavigator_;
 
-    // helper for creating programs from shader files
+    // helper for creating programs from shader files, optional #define lines
+    // are inserted after the #version line of each shader
     std::shared_ptr<QOpenGLShaderProgram> createProgram(const std::string& vertex,
                                                         const std::string& fragment,
-                                                        const std::string& geom = "");
+                                                        const std::string& geom = "",
+                                                        const std::string& defines = "");
 
     // helper for creating a node scaled to size 1
     std::shared_ptr<Node> createNode(std::shared_ptr<Mesh> mesh, bool scale_to_1 = true);
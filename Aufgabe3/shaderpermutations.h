@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QOpenGLShaderProgram>
+
+#include <functional> // std::function
+#include <map>
+#include <memory> // std::shared_ptr
+#include <string>
+#include <vector>
+
+/*
+ *  Specialized variants of one shader, selected by a feature bitmask.
+ *
+ *  Bit i of the mask turns on "#define <featureNames[i]>" in the shader
+ *  sources, so unused features (e.g. texture fetches) are compiled out
+ *  instead of being skipped by runtime branches.
+ *
+ *  Each variant is compiled on first request and cached per mask.
+ *  The factory gets the #define lines and returns the linked program.
+ *
+ */
+class ShaderPermutations
+{
+public:
+
+    using Factory = std::function<std::shared_ptr<QOpenGLShaderProgram>(const std::string& defines)>;
+
+    ShaderPermutations(const std::vector<std::string>& featureNames, Factory factory)
+        : featureNames_(featureNames), factory_(factory)
+    {}
+
+    // program for the feature mask, compiled if not yet in the cache
+    std::shared_ptr<QOpenGLShaderProgram> program(unsigned int mask) {
+        auto& prog = programs_[mask];
+        if(!prog)
+            prog = factory_(defines(mask));
+        return prog;
+    }
+
+    // #define lines for the feature mask
+    std::string defines(unsigned int mask) const {
+        std::string result;
+        for(size_t i=0; i<featureNames_.size(); i++)
+            if(mask & (1u << i))
+                result += "#define " + featureNames_[i] + "\n";
+        return result;
+    }
+
+    // number of variants compiled so far
+    size_t size() const { return programs_.size(); }
+
+private:
+    std::vector<std::string> featureNames_;
+    Factory factory_;
+    std::map<unsigned int, std::shared_ptr<QOpenGLShaderProgram>> programs_;
+};
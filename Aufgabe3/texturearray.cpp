@@ -0,0 +1,59 @@
+#include "texturearray.h"
+#include "glstatecache.h"
+
+using namespace std;
+
+TextureArray::TextureArray(int width, int height)
+    : width_(width), height_(height)
+{
+}
+
+int TextureArray::add(const QImage& image)
+{
+    if(texture_)
+        qFatal("TextureArray: cannot add layers after the texture was created");
+    if(image.width() != width_ || image.height() != height_)
+        return -1;
+
+    images_.push_back(image.convertToFormat(QImage::Format_RGBA8888));
+    return layers_++;
+}
+
+QOpenGLTexture& TextureArray::texture()
+{
+    if(!texture_)
+        create_();
+    return *texture_;
+}
+
+void TextureArray::bind(int unit)
+{
+    GLStateCache::current().bindTexture(unit, texture());
+}
+
+void TextureArray::create_()
+{
+    if(images_.empty())
+        qFatal("TextureArray: no layers");
+
+    texture_.reset(new QOpenGLTexture(QOpenGLTexture::Target2DArray));
+    texture_->create();
+    texture_->setSize(width_, height_);
+    texture_->setLayers(layers_);
+    texture_->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    texture_->setMipLevels(texture_->maximumMipLevels());
+    texture_->allocateStorage();
+
+    for(size_t layer=0; layer<images_.size(); layer++)
+        texture_->setData(0, int(layer), QOpenGLTexture::RGBA, QOpenGLTexture::UInt8,
+                          images_[layer].constBits());
+    texture_->generateMipMaps();
+
+    // same sampling as QOpenGLTexture(QImage)
+    texture_->setMinMagFilters(QOpenGLTexture::LinearMipMapLinear, QOpenGLTexture::Linear);
+    texture_->setWrapMode(QOpenGLTexture::Repeat);
+
+    // the pixels are on the GPU now
+    images_.clear();
+    images_.shrink_to_fit();
+}
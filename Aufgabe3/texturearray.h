@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QImage>
+#include <QOpenGLTexture>
+
+#include <memory> // std::unique_ptr
+#include <vector>
+
+/*
+ *  Packs 2D textures of one size into the layers of a single
+ *  GL_TEXTURE_2D_ARRAY, so that materials sharing the array need no
+ *  texture rebinds between their draws; they only differ in the layer
+ *  indices in their uniform block (see TexturedPhongMaterial).
+ *
+ *  Images are collected with add(); the array texture is created on
+ *  first use, with mip maps, and images cannot be added after that.
+ *
+ */
+class TextureArray
+{
+public:
+
+    // all layers have this size
+    TextureArray(int width, int height);
+
+    // add an image as a new layer, returns its index,
+    // or -1 if its size does not fit (then keep a separate texture)
+    int add(const QImage& image);
+
+    // number of layers
+    int size() const { return layers_; }
+
+    // bind to a texture unit, creating the array texture if necessary
+    void bind(int unit);
+
+    // the array texture, created if necessary
+    QOpenGLTexture& texture();
+
+private:
+
+    int width_, height_;
+    int layers_ = 0;
+
+    // layer images, until the texture is created
+    std::vector<QImage> images_;
+    std::unique_ptr<QOpenGLTexture> texture_;
+
+    void create_();
+};
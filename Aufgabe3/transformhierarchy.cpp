@@ -0,0 +1,393 @@
+#include "transformhierarchy.h"
+#include "camera.h"
+#include "node.h"
+#include "renderqueue.h"
+#include "frustum.h"
+#include "occlusionbuffer.h"
+#include "jobsystem.h"
+
+#include <algorithm> // std::fill, std::min, std::max, std::binary_search
+#include <limits>
+#include <math.h>   // fabsf
+#include <utility>   // std::pair
+
+using namespace std;
+
+void Transformation::changed_()
+{
+    for(int index : indices_)
+        hierarchy_->setLocal(index, matrix_);
+}
+
+TransformHierarchy::~TransformHierarchy()
+{
+    clear_();
+}
+
+void TransformHierarchy::clear_()
+{
+    for(auto& node : nodes_) {
+        if(node->transformation.hierarchy_ != this)
+            continue;
+        node->transformation.hierarchy_ = nullptr;
+        node->transformation.indices_.clear();
+    }
+    parent_.clear();
+    local_.clear();
+    world_.clear();
+    dirty_.clear();
+    inverse_.clear();
+    inverseValid_.clear();
+    mesh_.clear();
+    boxCenter_.clear();
+    boxRadii_.clear();
+    occluders_.clear();
+    bounds_.clear();
+    subtreeBounds_.clear();
+    subtreeEnd_.clear();
+    subtreeMeshes_.clear();
+    spine_.clear();
+    tops_.clear();
+    jobs_.clear();
+    nodes_.clear();
+    anyDirty_ = false;
+}
+
+void TransformHierarchy::build(const shared_ptr<Node>& root)
+{
+    clear_();
+
+    // depth-first, so parents get smaller indices than their children
+    vector<pair<shared_ptr<Node>, int>> stack = { { root, -1 } };
+    vector<shared_ptr<Node>> order;
+    while(!stack.empty()) {
+        shared_ptr<Node> node = stack.back().first;
+        int parent = stack.back().second;
+        stack.pop_back();
+
+        int index = int(parent_.size());
+        parent_.push_back(parent);
+        local_.push_back(node->transformation);
+        mesh_.push_back(node->mesh.get());
+        if(node->mesh) {
+            const BoundingBox& bbox = node->mesh->geometry()->bbox();
+            boxCenter_.push_back(bbox.center());
+            boxRadii_.push_back(bbox.radii());
+            if(node->occluder)
+                occluders_.push_back(index);
+        } else {
+            boxCenter_.push_back(QVector3D());
+            boxRadii_.push_back(QVector3D());
+        }
+        order.push_back(node);
+
+        for(auto it = node->children.rbegin(); it != node->children.rend(); ++it)
+            stack.push_back({ *it, index });
+    }
+
+    // all world matrices are computed in the first update
+    world_.resize(parent_.size());
+    dirty_.assign(parent_.size(), 1);
+    inverse_.resize(parent_.size());
+    inverseValid_.assign(parent_.size(), 0);
+    bounds_.resize(parent_.size());
+    subtreeBounds_.resize(parent_.size());
+
+    // subtree ranges and mesh counts, children before parents
+    const int n = size();
+    subtreeEnd_.resize(n);
+    subtreeMeshes_.resize(n);
+    for(int i=0; i<n; i++) {
+        subtreeEnd_[i] = i+1;
+        subtreeMeshes_[i] = mesh_[i]? 1 : 0;
+    }
+    for(int i=n-1; i>0; i--) {
+        int p = parent_[i];
+        subtreeEnd_[p] = max(subtreeEnd_[p], subtreeEnd_[i]);
+        subtreeMeshes_[p] += subtreeMeshes_[i];
+    }
+    anyDirty_ = true;
+
+    partition_();
+
+    // attach the nodes, so changes of their transformation reach us
+    for(size_t i=0; i<order.size(); i++) {
+        Transformation& t = order[i]->transformation;
+        if(t.hierarchy_ != this) {
+            t.hierarchy_ = this;
+            t.indices_.clear();
+            nodes_.push_back(order[i]);
+        }
+        t.indices_.push_back(int(i));
+    }
+}
+
+void TransformHierarchy::setLocal(int index, const QMatrix4x4& matrix)
+{
+    local_[index] = matrix;
+    dirty_[index] = 1;
+    anyDirty_ = true;
+}
+
+void TransformHierarchy::update()
+{
+    if(!anyDirty_)
+        return;
+
+    // first the spine, then the subtrees below it in parallel
+    for(int i : spine_)
+        updateNode_(i);
+    JobSystem::instance().parallelFor(int(jobs_.size()), [this](int j) {
+        const int begin = jobs_[j].first, end = jobs_[j].second;
+        for(int i=begin; i<end; i++)
+            updateNode_(i);
+
+        // subtree bounds, children (larger indices) before their parents
+        for(int i=begin; i<end; i++)
+            initSubtreeBounds_(i);
+        for(int i=end-1; i>begin; i--)
+            if(parent_[i] >= begin)
+                mergeSubtreeBounds_(i);
+    });
+
+    // the parents of the jobs' subtrees are in the spine
+    for(int i : spine_)
+        initSubtreeBounds_(i);
+    for(auto it = tops_.rbegin(); it != tops_.rend(); ++it)
+        if(parent_[*it] >= 0)
+            mergeSubtreeBounds_(*it);
+
+    fill(dirty_.begin(), dirty_.end(), uint8_t(0));
+    anyDirty_ = false;
+}
+
+void TransformHierarchy::updateNode_(int i)
+{
+    // a node is dirty if it changed itself, or if its parent is dirty
+    int p = parent_[i];
+    if(p >= 0 && dirty_[p])
+        dirty_[i] = 1;
+    if(dirty_[i]) {
+        world_[i] = p >= 0? world_[p] * local_[i] : local_[i];
+        inverseValid_[i] = 0;
+        if(mesh_[i])
+            worldBounds_(i);
+    }
+}
+
+void TransformHierarchy::initSubtreeBounds_(int i)
+{
+    const float inf = numeric_limits<float>::infinity();
+    subtreeBounds_[i] = mesh_[i]? bounds_[i] : Bounds{ { inf, inf, inf }, { -inf, -inf, -inf } };
+}
+
+void TransformHierarchy::mergeSubtreeBounds_(int i)
+{
+    Bounds& parent = subtreeBounds_[parent_[i]];
+    const Bounds& child = subtreeBounds_[i];
+    for(int k=0; k<3; k++) {
+        parent.min[k] = min(parent.min[k], child.min[k]);
+        parent.max[k] = max(parent.max[k], child.max[k]);
+    }
+}
+
+void TransformHierarchy::partition_()
+{
+    // subtrees of up to grain nodes go to jobs, larger ones are split
+    // at their root, which becomes part of the spine
+    const int n = size();
+    const int grain = max(256, n / (4*JobSystem::instance().numThreads()));
+    int i = 0;
+    while(i < n) {
+        if(parent_[i] < 0 || subtreeEnd_[i] - i > grain) {
+            spine_.push_back(i);
+            tops_.push_back(i);
+            i++;
+            continue;
+        }
+
+        // pack adjacent small subtrees into one job
+        int end = subtreeEnd_[i];
+        if(!jobs_.empty() && jobs_.back().second == i && end - jobs_.back().first <= grain)
+            jobs_.back().second = end;
+        else
+            jobs_.push_back({ i, end });
+        tops_.push_back(i);
+        i = end;
+    }
+}
+
+const QMatrix4x4& TransformHierarchy::worldMatrix(int index)
+{
+    update();
+    return world_[index];
+}
+
+const QMatrix4x4& TransformHierarchy::worldInverse(int index)
+{
+    update();
+    if(!inverseValid_[index]) {
+        inverse_[index] = world_[index].inverted();
+        inverseValid_[index] = 1;
+    }
+    return inverse_[index];
+}
+
+bool TransformHierarchy::isBelow_(int ancestor, int descendant) const
+{
+    // everything is below the root
+    if(ancestor == 0)
+        return descendant >= 0 && descendant < size();
+
+    // parents have smaller indices, so walk up until passing the ancestor
+    int i = descendant;
+    while(i > ancestor)
+        i = parent_[i];
+    return i == ancestor;
+}
+
+bool TransformHierarchy::relative(int ancestor, int descendant, QMatrix4x4& result)
+{
+    if(!isBelow_(ancestor, descendant))
+        return false;
+    int p = parent_[ancestor];
+    result = p < 0? worldMatrix(descendant) : worldInverse(p) * worldMatrix(descendant);
+    return true;
+}
+
+bool TransformHierarchy::relativeInverse(int ancestor, int descendant, QMatrix4x4& result)
+{
+    if(!isBelow_(ancestor, descendant))
+        return false;
+    int p = parent_[ancestor];
+    result = p < 0? worldInverse(descendant) : worldInverse(descendant) * worldMatrix(p);
+    return true;
+}
+
+bool TransformHierarchy::isOccluder_(int index) const
+{
+    return binary_search(occluders_.begin(), occluders_.end(), index);
+}
+
+void TransformHierarchy::worldBounds_(int i)
+{
+    // center transforms as a point, the radii by the absolute matrix
+    const QMatrix4x4& m = world_[i];
+    QVector3D c = m * boxCenter_[i];
+    const QVector3D& r = boxRadii_[i];
+    for(int k=0; k<3; k++) {
+        float e = fabsf(m(k,0))*r.x() + fabsf(m(k,1))*r.y() + fabsf(m(k,2))*r.z();
+        bounds_[i].min[k] = c[k] - e;
+        bounds_[i].max[k] = c[k] + e;
+    }
+}
+
+vector<QVector3D> TransformHierarchy::occluderCorners()
+{
+    update();
+
+    // the mesh box in model coordinates, transformed as a whole
+    vector<QVector3D> corners;
+    corners.reserve(8*occluders_.size());
+    for(int i : occluders_) {
+        const QVector3D& c = boxCenter_[i];
+        const QVector3D& r = boxRadii_[i];
+        for(int k=0; k<8; k++) {
+            QVector3D corner(k&1? r.x() : -r.x(), k&2? r.y() : -r.y(), k&4? r.z() : -r.z());
+            corners.push_back(world_[i] * (c + corner));
+        }
+    }
+    return corners;
+}
+
+void TransformHierarchy::gather(const Camera& camera, RenderQueue& queue, OcclusionBuffer* occlusion)
+{
+    update();
+    if(occlusion)
+        occlusion->wait();
+
+    const QMatrix4x4 view = camera.viewMatrix();
+    Frustum frustum(camera.projectionMatrix() * view);
+
+    // one job per range of subtrees, plus one for the meshes in the spine
+    const int numJobs = int(jobs_.size());
+    jobVisible_.resize(numJobs+1);
+    jobStats_.resize(numJobs+1);
+    JobSystem::instance().parallelFor(numJobs+1, [&](int j) {
+        jobVisible_[j].clear();
+        jobStats_[j] = CullStats();
+        if(j < numJobs) {
+            cullRange_(jobs_[j].first, jobs_[j].second, frustum, occlusion, view, jobVisible_[j], jobStats_[j]);
+            return;
+        }
+        for(int i : spine_) {
+            if(mesh_[i])
+                cullMesh_(i, frustum, occlusion, view, jobVisible_[j], jobStats_[j]);
+        }
+    });
+
+    // the ids in the sort keys are handed out here, in a fixed order
+    cullStats_ = CullStats();
+    for(int j=0; j<=numJobs; j++) {
+        for(const Visible& v : jobVisible_[j])
+            queue.add(*mesh_[v.index], world_[v.index], v.depth);
+        cullStats_.drawn += jobStats_[j].drawn;
+        cullStats_.culled += jobStats_[j].culled;
+        cullStats_.occluded += jobStats_[j].occluded;
+    }
+}
+
+void TransformHierarchy::cullRange_(int begin, int end, const Frustum& frustum, const OcclusionBuffer* occlusion,
+                                    const QMatrix4x4& view, vector<Visible>& visible, CullStats& stats) const
+{
+    int i = begin;
+    while(i < end) {
+
+        // skip subtrees without meshes, completely outside or hidden
+        const Bounds& subtree = subtreeBounds_[i];
+        if(!subtreeMeshes_[i] || !frustum.intersects(subtree.min, subtree.max)) {
+            stats.culled += subtreeMeshes_[i];
+            i = subtreeEnd_[i];
+            continue;
+        }
+        const bool leaf = subtreeEnd_[i] == i+1;
+        if(occlusion && !(leaf && isOccluder_(i)) && !occlusion->isVisible(subtree.min, subtree.max)) {
+            stats.occluded += subtreeMeshes_[i];
+            i = subtreeEnd_[i];
+            continue;
+        }
+
+        // for a leaf the subtree tests were the mesh tests
+        if(mesh_[i]) {
+            if(leaf) {
+                visible.push_back({ i, viewDepth_(i, view) });
+                stats.drawn++;
+            } else {
+                cullMesh_(i, frustum, occlusion, view, visible, stats);
+            }
+        }
+        i++;
+    }
+}
+
+void TransformHierarchy::cullMesh_(int i, const Frustum& frustum, const OcclusionBuffer* occlusion,
+                                   const QMatrix4x4& view, vector<Visible>& visible, CullStats& stats) const
+{
+    const Bounds& b = bounds_[i];
+    if(!frustum.intersects(b.min, b.max)) {
+        stats.culled++;
+    } else if(occlusion && !isOccluder_(i) && !occlusion->isVisible(b.min, b.max)) {
+        stats.occluded++;
+    } else {
+        visible.push_back({ i, viewDepth_(i, view) });
+        stats.drawn++;
+    }
+}
+
+float TransformHierarchy::viewDepth_(int i, const QMatrix4x4& view) const
+{
+    // depth of the bounding box center, the camera looks along -Z
+    const Bounds& b = bounds_[i];
+    QVector3D center(0.5f*(b.min[0]+b.max[0]), 0.5f*(b.min[1]+b.max[1]), 0.5f*(b.min[2]+b.max[2]));
+    return -(view * center).z();
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include <cstdint> // uint8_t
+#include <memory>  // std::shared_ptr
+#include <utility> // std::pair
+#include <vector>
+
+class Camera;
+class Frustum;
+class Mesh;
+class Node;
+class OcclusionBuffer;
+class RenderQueue;
+class TransformHierarchy;
+
+/*
+ *  The local transformation of a Node.
+ *
+ *  Behaves like a QMatrix4x4 for reading, and offers the usual
+ *  modifiers (translate, rotate, scale, assignment). If the node is
+ *  part of a TransformHierarchy, each modification is passed on to it,
+ *  which then only recomputes the world matrices below this node.
+ *
+ */
+class Transformation
+{
+public:
+
+    Transformation(const QMatrix4x4& matrix = QMatrix4x4()) : matrix_(matrix) {}
+
+    // copies get the matrix, but are not part of any hierarchy
+    Transformation(const Transformation& other) : matrix_(other.matrix_) {}
+    Transformation& operator=(const Transformation& other) { return *this = other.matrix_; }
+
+    Transformation& operator=(const QMatrix4x4& matrix) {
+        matrix_ = matrix; changed_(); return *this;
+    }
+
+    // the hierarchy containing the node, and its index there
+    // (-1 if not contained exactly once)
+    TransformHierarchy* hierarchy() const { return hierarchy_; }
+    int index() const { return indices_.size() == 1? indices_[0] : -1; }
+
+    // read access
+    operator const QMatrix4x4&() const { return matrix_; }
+    const QMatrix4x4& matrix() const { return matrix_; }
+    QVector4D column(int index) const { return matrix_.column(index); }
+
+    // modifiers, same as in QMatrix4x4
+    void translate(const QVector3D& vector) { matrix_.translate(vector); changed_(); }
+    void rotate(float angle, const QVector3D& axis) { matrix_.rotate(angle, axis); changed_(); }
+    void scale(const QVector3D& vector) { matrix_.scale(vector); changed_(); }
+
+private:
+
+    QMatrix4x4 matrix_;
+
+    // where this node is in a hierarchy (more than once if shared by several parents)
+    TransformHierarchy* hierarchy_ = nullptr;
+    std::vector<int> indices_;
+
+    void changed_();
+
+    friend class TransformHierarchy;
+};
+
+/*
+ *  Flattened copy of a node tree for fast per-frame processing.
+ *
+ *  Nodes are stored in depth-first order, so every parent comes before
+ *  its children, in plain arrays (parent index, local and world matrix,
+ *  dirty flag, mesh). update() then computes all world matrices in one
+ *  linear pass, and only for nodes whose transformation or one of whose
+ *  ancestors' transformations changed since the last update.
+ *
+ *  Each node also gets a world space bounding box of its mesh and one of
+ *  its whole subtree. Since a subtree is a consecutive range of nodes,
+ *  gather() skips invisible subtrees in one step (view-frustum culling).
+ *  Given an OcclusionBuffer, it also skips subtrees and meshes hidden
+ *  behind the nodes marked as occluders (see occluderCorners()).
+ *
+ *  Both run on the JobSystem: build() splits the tree into a spine of
+ *  large subtrees' roots, processed first, and ranges of small
+ *  subtrees below it, which are processed in parallel.
+ *
+ *  The Node objects remain the interface for building and modifying the
+ *  scene; call build() again after changing children or meshes.
+ *
+ */
+class TransformHierarchy
+{
+public:
+
+    TransformHierarchy() {}
+    ~TransformHierarchy();
+
+    // flatten the tree below root (replaces the previous contents)
+    void build(const std::shared_ptr<Node>& root);
+
+    // recompute the world matrices of all changed nodes
+    void update();
+
+    // add a draw for each visible node with a mesh, updating first if necessary;
+    // occluders themselves are never tested against the occlusion buffer
+    void gather(const Camera& camera, RenderQueue& queue, OcclusionBuffer* occlusion = nullptr);
+
+    // the 8 world space corners of each occluder's mesh box, for OcclusionBuffer::start()
+    std::vector<QVector3D> occluderCorners();
+
+    // numbers of meshes drawn / outside the frustum / hidden by occluders in the last gather()
+    struct CullStats {
+        size_t drawn = 0;
+        size_t culled = 0;
+        size_t occluded = 0;
+    };
+    const CullStats& cullStats() const { return cullStats_; }
+
+    // number of flattened nodes
+    int size() const { return int(parent_.size()); }
+
+    // per node data, valid after update()
+    int parent(int index) const { return parent_[index]; }
+    const QMatrix4x4& local(int index) const { return local_[index]; }
+    const QMatrix4x4& world(int index) const { return world_[index]; }
+
+    // world matrix and its inverse, updating first if anything changed;
+    // the inverse is computed once per change of the world matrix
+    const QMatrix4x4& worldMatrix(int index);
+    const QMatrix4x4& worldInverse(int index);
+
+    /*
+     *  transformation from the coordinates of descendant to those of
+     *  ancestor's parent (see Node::toWorldTransform), or its inverse.
+     *  O(1) for the root, O(depth) otherwise; false if descendant is
+     *  not below ancestor.
+     */
+    bool relative(int ancestor, int descendant, QMatrix4x4& result);
+    bool relativeInverse(int ancestor, int descendant, QMatrix4x4& result);
+
+    // called by Transformation when a node's local matrix changes
+    void setLocal(int index, const QMatrix4x4& matrix);
+
+    // no copies, the nodes refer to this object
+    TransformHierarchy(const TransformHierarchy&) = delete;
+    TransformHierarchy& operator=(const TransformHierarchy&) = delete;
+
+protected:
+
+    // hot data, one entry per flattened node
+    std::vector<int> parent_; // -1 for the root
+    std::vector<QMatrix4x4> local_;
+    std::vector<QMatrix4x4> world_;
+    std::vector<uint8_t> dirty_;
+    bool anyDirty_ = false;
+
+    // inverse world matrices, computed on demand
+    std::vector<QMatrix4x4> inverse_;
+    std::vector<uint8_t> inverseValid_;
+
+    // for drawing: mesh (owned by the node) and its bounding box in model coordinates
+    std::vector<Mesh*> mesh_;
+    std::vector<QVector3D> boxCenter_, boxRadii_;
+
+    // indices of the nodes marked as occluders
+    std::vector<int> occluders_;
+
+    // partition for the JobSystem: the spine (roots of large subtrees, in
+    // order), ranges [first, second) of small subtrees below it, and the
+    // roots of both (all nodes whose parent is in the spine, plus the root)
+    std::vector<int> spine_;
+    std::vector<std::pair<int,int>> jobs_;
+    std::vector<int> tops_;
+    void partition_();
+
+    // per job results of gather()
+    struct Visible {
+        int index;
+        float depth;
+    };
+    std::vector<std::vector<Visible>> jobVisible_;
+    std::vector<CullStats> jobStats_;
+
+    // world space bounding boxes of the mesh and of the whole subtree
+    struct Bounds {
+        float min[3], max[3];
+    };
+    std::vector<Bounds> bounds_, subtreeBounds_;
+
+    // the subtree of node i is [i, subtreeEnd_[i]), with this many meshes
+    std::vector<int> subtreeEnd_;
+    std::vector<int> subtreeMeshes_;
+
+    CullStats cullStats_;
+
+    // the nodes, only needed when building
+    std::vector<std::shared_ptr<Node>> nodes_;
+
+    // detach all nodes from this hierarchy
+    void clear_();
+
+    // is the node in occluders_ (kept sorted by build())?
+    bool isOccluder_(int index) const;
+
+    // is descendant in the subtree of ancestor?
+    bool isBelow_(int ancestor, int descendant) const;
+
+    // world space box of node i's mesh, from its world matrix
+    void worldBounds_(int i);
+
+    // parts of update()
+    void updateNode_(int i);
+    void initSubtreeBounds_(int i);
+    void mergeSubtreeBounds_(int i);
+
+    // parts of gather(): subtrees in [begin, end), a single mesh, depth of its box center
+    void cullRange_(int begin, int end, const Frustum& frustum, const OcclusionBuffer* occlusion,
+                    const QMatrix4x4& view, std::vector<Visible>& visible, CullStats& stats) const;
+    void cullMesh_(int i, const Frustum& frustum, const OcclusionBuffer* occlusion,
+                   const QMatrix4x4& view, std::vector<Visible>& visible, CullStats& stats) const;
+    float viewDepth_(int i, const QMatrix4x4& view) const;
+};
@@ -0,0 +1,123 @@
+#include "uniformbuffer.h"
+
+#include <QOpenGLContext>
+
+#include <assert.h>
+
+using namespace std;
+
+shared_ptr<UniformBufferPool> UniformBufferPool::current()
+{
+    static map<QOpenGLContext*, shared_ptr<UniformBufferPool>> pools;
+
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    assert(context);
+
+    auto& pool = pools[context];
+    if(!pool) {
+        pool.reset(new UniformBufferPool(context));
+        // the buffer dies with the context, slots still around notice via weak_ptr
+        QObject::connect(context, &QOpenGLContext::aboutToBeDestroyed,
+                         [context] { pools.erase(context); });
+    }
+    return pool;
+}
+
+UniformBufferPool::UniformBufferPool(QOpenGLContext* context)
+    : QOpenGLExtraFunctions(context)
+{
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment_);
+    glGenBuffers(1, &buffer_);
+    grow_(64*1024);
+}
+
+UniformBufferPool::~UniformBufferPool()
+{
+    glDeleteBuffers(1, &buffer_);
+}
+
+GLintptr UniformBufferPool::allocate(GLsizeiptr size)
+{
+    size = aligned_(size);
+
+    auto& ranges = freeRanges_[size];
+    if(!ranges.empty()) {
+        GLintptr offset = ranges.back();
+        ranges.pop_back();
+        return offset;
+    }
+
+    if(used_ + size > capacity_)
+        grow_(max(capacity_*2, used_ + size));
+    GLintptr offset = used_;
+    used_ += size;
+    return offset;
+}
+
+void UniformBufferPool::free(GLintptr offset, GLsizeiptr size)
+{
+    freeRanges_[aligned_(size)].push_back(offset);
+}
+
+void UniformBufferPool::upload(GLintptr offset, const void* data, GLsizeiptr size)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+    glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+}
+
+void UniformBufferPool::bind(GLuint binding, GLintptr offset, GLsizeiptr size)
+{
+    bindings_[binding] = make_pair(offset, size);
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer_, offset, size);
+}
+
+void UniformBufferPool::grow_(GLsizeiptr minCapacity)
+{
+    GLuint bigger;
+    glGenBuffers(1, &bigger);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bigger);
+    glBufferData(GL_COPY_WRITE_BUFFER, minCapacity, nullptr, GL_DYNAMIC_DRAW);
+
+    // offsets stay the same, so existing slots remain valid
+    if(used_ > 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer_);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used_);
+    }
+    glDeleteBuffers(1, &buffer_);
+
+    buffer_ = bigger;
+    capacity_ = minCapacity;
+
+    // deleting the old buffer unbound it from all binding points, but
+    // blocks bound earlier in the frame (e.g. the FrameBlock) are still
+    // expected there by the following draws
+    for(const auto& b : bindings_)
+        glBindBufferRange(GL_UNIFORM_BUFFER, b.first, buffer_, b.second.first, b.second.second);
+}
+
+UniformBlockSlot::~UniformBlockSlot()
+{
+    if(auto pool = pool_.lock())
+        pool->free(offset_, size_);
+}
+
+void UniformBlockSlot::upload(const void* data, GLsizeiptr size)
+{
+    auto pool = pool_.lock();
+    if(!pool || size != size_) {
+        if(pool)
+            pool->free(offset_, size_);
+        pool = UniformBufferPool::current();
+        pool_ = pool;
+        offset_ = pool->allocate(size);
+        size_ = size;
+    }
+    pool->upload(offset_, data, size);
+}
+
+void UniformBlockSlot::bind(GLuint binding)
+{
+    auto pool = pool_.lock();
+    assert(pool);
+    pool->bind(binding, offset_, size_);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <QOpenGLExtraFunctions>
+
+#include <map>
+#include <memory> // std::shared_ptr, std::weak_ptr
+#include <utility> // std::pair
+#include <vector>
+
+class QOpenGLContext;
+
+/*
+ *  One large uniform buffer per OpenGL context, shared by many small
+ *  uniform blocks (e.g. the parameters of each material).
+ *
+ *  Blocks are sub-allocated at offsets that are multiples of
+ *  GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, so each of them can be bound
+ *  with glBindBufferRange(). The buffer grows as needed, also in the
+ *  middle of a frame; ranges bound with bind() are then bound again to
+ *  the new buffer. Freed ranges are reused for blocks of the same size.
+ *
+ *  Usually not used directly, see UniformBlockSlot.
+ *
+ */
+class UniformBufferPool : protected QOpenGLExtraFunctions
+{
+public:
+
+    // pool of the current context, created on first use
+    static std::shared_ptr<UniformBufferPool> current();
+
+    ~UniformBufferPool();
+
+    // reserve / release a range of at least size bytes, returns the offset
+    GLintptr allocate(GLsizeiptr size);
+    void free(GLintptr offset, GLsizeiptr size);
+
+    // copy data into the buffer / bind a range to a uniform buffer binding point
+    void upload(GLintptr offset, const void* data, GLsizeiptr size);
+    void bind(GLuint binding, GLintptr offset, GLsizeiptr size);
+
+private:
+
+    explicit UniformBufferPool(QOpenGLContext* context);
+
+    GLuint buffer_ = 0;
+    GLsizeiptr capacity_ = 0;
+    GLsizeiptr used_ = 0;
+    GLint alignment_ = 256;
+
+    // released ranges by (aligned) size
+    std::map<GLsizeiptr, std::vector<GLintptr>> freeRanges_;
+
+    // range last bound to each binding point (offset, size), see grow_()
+    std::map<GLuint, std::pair<GLintptr, GLsizeiptr>> bindings_;
+
+    // make room for at least the given number of bytes, keeping the
+    // contents and the bound ranges
+    void grow_(GLsizeiptr minCapacity);
+
+    GLsizeiptr aligned_(GLsizeiptr size) const {
+        return (size + alignment_ - 1) / alignment_ * alignment_;
+    }
+};
+
+/*
+ *  A range in the pool of the current context, allocated on first upload
+ *  and released when the slot is destroyed.
+ *
+ *  Copying a slot yields an unallocated slot, so a copied material gets
+ *  its own range instead of sharing (and overwriting) the original one.
+ *
+ */
+class UniformBlockSlot
+{
+public:
+
+    UniformBlockSlot() {}
+    UniformBlockSlot(const UniformBlockSlot&) {}
+    UniformBlockSlot& operator=(const UniformBlockSlot&) { return *this; }
+    ~UniformBlockSlot();
+
+    // has data been uploaded to this slot yet?
+    bool allocated() const { return !pool_.expired(); }
+
+    // copy block data into the slot, allocating it if necessary
+    void upload(const void* data, GLsizeiptr size);
+
+    // bind the slot's range to a uniform buffer binding point
+    void bind(GLuint binding);
+
+private:
+
+    std::weak_ptr<UniformBufferPool> pool_;
+    GLintptr offset_ = 0;
+    GLsizeiptr size_ = 0;
+};